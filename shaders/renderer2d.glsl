@@ -31,7 +31,8 @@ in vec2 tex_coords;
 flat in int tex_index;
 in vec4 frag_color;
 
-uniform sampler2D uTextures[12];
+// Texture batches used by the draw, indexed by tex_index. 16 is the minimum number of texture units guaranteed by GL 3.3.
+uniform sampler2D uTextures[16];
 
 void main()
 {
@@ -61,6 +62,14 @@ void main()
         color *= texture(uTextures[10], tex_coords);
     else if (tex_index == 11)
         color *= texture(uTextures[11], tex_coords);
+    else if (tex_index == 12)
+        color *= texture(uTextures[12], tex_coords);
+    else if (tex_index == 13)
+        color *= texture(uTextures[13], tex_coords);
+    else if (tex_index == 14)
+        color *= texture(uTextures[14], tex_coords);
+    else if (tex_index == 15)
+        color *= texture(uTextures[15], tex_coords);
 
     FragColor = color;
 }
\ No newline at end of file
@@ -0,0 +1,44 @@
+@vertex
+#version 330 core
+layout (location = 0) in vec3 aPosition;
+layout (location = 1) in vec2 aTexCoords;
+layout (location = 2) in float aTexIndex;
+layout (location = 3) in vec4 aColor;
+
+out vec3 frag_position;
+out vec2 tex_coords;
+flat out int tex_index;
+out vec4 frag_color;
+
+uniform mat4 PV;    //  Projection * view matrix
+
+void main()
+{
+    frag_position = aPosition;
+    tex_coords = aTexCoords;
+    tex_index = int(aTexIndex);
+    frag_color = aColor;
+
+    gl_Position = PV * vec4(aPosition, 1.0);
+}
+
+@fragment
+#version 330 core
+out vec4 FragColor;
+
+in vec3 frag_position;
+in vec2 tex_coords;
+flat in int tex_index;
+in vec4 frag_color;
+
+// Texture batch, whose pages are layers of the array. tex_index is the layer.
+uniform sampler2DArray uTextureArray;
+
+void main()
+{
+    vec4 color = frag_color;
+    if (tex_index >= 0)
+        color *= texture(uTextureArray, vec3(tex_coords, float(tex_index)));
+
+    FragColor = color;
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+@vertex
+#version 330 core
+// Corner of the unit quad.
+layout (location = 0) in vec2 aCorner;
+// Per-instance attributes.
+layout (location = 1) in vec2 aPosition;
+layout (location = 2) in vec2 aScale;
+layout (location = 3) in float aRotation;   // In degrees.
+layout (location = 4) in vec4 aUVRect;      // Offset in xy, size in zw.
+layout (location = 5) in float aTexIndex;
+layout (location = 6) in vec4 aColor;
+
+out vec3 frag_position;
+out vec2 tex_coords;
+flat out int tex_index;
+out vec4 frag_color;
+
+uniform mat4 PV;    //  Projection * view matrix
+
+void main()
+{
+    // Same as Renderer2D::Transform::getModelMatrix(): scale the unit quad, then rotate it around its center.
+    float angle = radians(-aRotation);
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    vec2 half_size = 0.5 * aScale;
+    vec2 position = aPosition + half_size + rotation * (aCorner * aScale - half_size);
+
+    frag_position = vec3(position, 0.0);
+    tex_coords = aUVRect.xy + aCorner * aUVRect.zw;
+    tex_index = int(aTexIndex);
+    frag_color = aColor;
+
+    gl_Position = PV * vec4(position, 0.0, 1.0);
+}
+
+@fragment
+#version 330 core
+out vec4 FragColor;
+
+in vec3 frag_position;
+in vec2 tex_coords;
+flat in int tex_index;
+in vec4 frag_color;
+
+// Texture batches used by the draw, indexed by tex_index. 16 is the minimum number of texture units guaranteed by GL 3.3.
+uniform sampler2D uTextures[16];
+
+void main()
+{
+    vec4 color = frag_color;
+
+    if (tex_index == 0)
+        color *= texture(uTextures[0], tex_coords);
+    else if (tex_index == 1)
+        color *= texture(uTextures[1], tex_coords);
+    else if (tex_index == 2)
+        color *= texture(uTextures[2], tex_coords);
+    else if (tex_index == 3)
+        color *= texture(uTextures[3], tex_coords);
+    else if (tex_index == 4)
+        color *= texture(uTextures[4], tex_coords);
+    else if (tex_index == 5)
+        color *= texture(uTextures[5], tex_coords);
+    else if (tex_index == 6)
+        color *= texture(uTextures[6], tex_coords);
+    else if (tex_index == 7)
+        color *= texture(uTextures[7], tex_coords);
+    else if (tex_index == 8)
+        color *= texture(uTextures[8], tex_coords);
+    else if (tex_index == 9)
+        color *= texture(uTextures[9], tex_coords);
+    else if (tex_index == 10)
+        color *= texture(uTextures[10], tex_coords);
+    else if (tex_index == 11)
+        color *= texture(uTextures[11], tex_coords);
+    else if (tex_index == 12)
+        color *= texture(uTextures[12], tex_coords);
+    else if (tex_index == 13)
+        color *= texture(uTextures[13], tex_coords);
+    else if (tex_index == 14)
+        color *= texture(uTextures[14], tex_coords);
+    else if (tex_index == 15)
+        color *= texture(uTextures[15], tex_coords);
+
+    FragColor = color;
+}
\ No newline at end of file
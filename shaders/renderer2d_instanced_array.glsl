@@ -0,0 +1,55 @@
+@vertex
+#version 330 core
+// Corner of the unit quad.
+layout (location = 0) in vec2 aCorner;
+// Per-instance attributes.
+layout (location = 1) in vec2 aPosition;
+layout (location = 2) in vec2 aScale;
+layout (location = 3) in float aRotation;   // In degrees.
+layout (location = 4) in vec4 aUVRect;      // Offset in xy, size in zw.
+layout (location = 5) in float aTexIndex;
+layout (location = 6) in vec4 aColor;
+
+out vec3 frag_position;
+out vec2 tex_coords;
+flat out int tex_index;
+out vec4 frag_color;
+
+uniform mat4 PV;    //  Projection * view matrix
+
+void main()
+{
+    // Same as Renderer2D::Transform::getModelMatrix(): scale the unit quad, then rotate it around its center.
+    float angle = radians(-aRotation);
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    vec2 half_size = 0.5 * aScale;
+    vec2 position = aPosition + half_size + rotation * (aCorner * aScale - half_size);
+
+    frag_position = vec3(position, 0.0);
+    tex_coords = aUVRect.xy + aCorner * aUVRect.zw;
+    tex_index = int(aTexIndex);
+    frag_color = aColor;
+
+    gl_Position = PV * vec4(position, 0.0, 1.0);
+}
+
+@fragment
+#version 330 core
+out vec4 FragColor;
+
+in vec3 frag_position;
+in vec2 tex_coords;
+flat in int tex_index;
+in vec4 frag_color;
+
+// Texture batch, whose pages are layers of the array. tex_index is the layer.
+uniform sampler2DArray uTextureArray;
+
+void main()
+{
+    vec4 color = frag_color;
+    if (tex_index >= 0)
+        color *= texture(uTextureArray, vec3(tex_coords, float(tex_index)));
+
+    FragColor = color;
+}
\ No newline at end of file
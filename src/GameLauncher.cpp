@@ -73,7 +73,10 @@ void GameLauncher::Launch()
             // Clear default framebuffer and render game scene.
             RenderAPI::SetClearColor(glm::vec4(game_instance->BackgroundColor, 1.0f));
             RenderAPI::Clear();
+            // Commands queued by the renderers during Render() are sorted and drawn at the end of the scene.
+            Renderer::BeginScene();
             game_instance->Render();
+            Renderer::EndScene();
             if (ImGuiFrameHandler)
                 ImGuiFrameHandler();
             ImGui::Render();
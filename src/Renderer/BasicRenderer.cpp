@@ -4,6 +4,21 @@
 
 using namespace Ren;
 
+namespace
+{
+	// Uniforms of a queued draw.
+	struct br_Uniforms
+	{
+		glm::mat4 model;
+		glm::vec3 color;
+
+		void Apply(const Shader& shader) const
+		{
+			shader.SetMat4("model", model);
+			shader.SetVec3f("color", color);
+		}
+	};
+}
 
 BasicRenderer::BasicRenderer(Shader shader)
 	: mp_shape_info(), shader(shader), lineWidth(1.0f)
@@ -34,14 +49,38 @@ void BasicRenderer::SetLineWidth(float width)
 	glLineWidth(width);
 	lineWidth = width;
 }
+void BasicRenderer::SetRenderQueue(RenderQueue* p_queue, uint32_t pass, int32_t layer)
+{
+	this->p_queue = p_queue;
+	queue_key = RenderQueue::MakeKey(pass, layer, shader.ID);
+}
+void BasicRenderer::draw(unsigned int VAO, unsigned int mode, unsigned int count, const glm::mat4& model, glm::vec3 color)
+{
+	if (p_queue)
+	{
+		RenderQueue::DrawCommand cmd;
+		cmd.shader = shader.ID;
+		cmd.vao = VAO;
+		cmd.mode = mode;
+		cmd.count = count;
+		p_queue->Submit(queue_key, cmd, br_Uniforms{ model, color });
+		return;
+	}
+
+	this->shader.Use();
+	this->shader.SetMat4("model", model);
+	this->shader.SetVec3f("color", color);
+
+	glBindVertexArray(VAO);
+	glDrawArrays(mode, 0, count);
+	glBindVertexArray(0);
+}
 
 void BasicRenderer::RenderShape(br_Shape shape, glm::vec2 position, glm::vec2 scale, float rotate_radians, glm::vec3 color)
 {
 	if (mp_shape_info[shape].VBO == 0)
 		initShape(shape);
 
-	this->shader.Use();
-
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::translate(model, glm::vec3(position, 0.0));
 	model = glm::translate(model, glm::vec3(0.5f * scale.x, 0.5f * scale.y, 0.0f));
@@ -49,52 +88,40 @@ void BasicRenderer::RenderShape(br_Shape shape, glm::vec2 position, glm::vec2 sc
 	model = glm::translate(model, glm::vec3(-0.5f * scale.x, -0.5f * scale.y, 0.0f));
 	model = glm::scale(model, glm::vec3(scale, 1.0f));
 
-	this->shader.SetMat4("model", model);
-	this->shader.SetVec3f("color", color);
-
-	glBindVertexArray(mp_shape_info[shape].VAO);
-	glDrawArrays(mp_shape_info[shape].mode, 0, mp_shape_info[shape].n_strips);
-	glBindVertexArray(0);
+	const br_RenderInfo& inf = mp_shape_info[shape];
+	draw(inf.VAO, inf.mode, inf.n_strips, model, color);
 }
 void BasicRenderer::RenderShape(br_Shape shape, glm::mat4 customModel, glm::vec3 color)
 {
 	if (mp_shape_info[shape].VBO == 0)
 		initShape(shape);
 
-	this->shader.Use();
-	this->shader.SetMat4("model", customModel);
-	this->shader.SetVec3f("color", color);
-
-	glBindVertexArray(mp_shape_info[shape].VAO);
-	glDrawArrays(mp_shape_info[shape].mode, 0, mp_shape_info[shape].n_strips);
-	glBindVertexArray(0);
+	const br_RenderInfo& inf = mp_shape_info[shape];
+	draw(inf.VAO, inf.mode, inf.n_strips, customModel, color);
 }
 void BasicRenderer::RenderLine(glm::vec2 p1, glm::vec2 p2, glm::vec3 color)
 {
 	if (line_VBO == 0)
 		initLineBuffers();
 
-	glBindBuffer(GL_ARRAY_BUFFER, line_VBO);
-	float arr[4] = { p1.x, p1.y, p2.x, p2.y };
-	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(arr), arr);
-
-	this->shader.Use();
-	this->shader.SetMat4("model", glm::mat4(1.0f));
-	this->shader.SetVec3f("color", color);
-
-	glBindVertexArray(line_VAO);
-	glDrawArrays(GL_LINES, 0, 2);
+	// Line buffer holds line from (0, 0) to (1, 0), which is mapped to p1 -> p2 by the model matrix.
+	// So the buffer is never updated and the lines can be queued.
+	glm::vec2 dir = p2 - p1;
+	glm::mat4 model(1.0f);
+	model[0] = glm::vec4(dir, 0.0f, 0.0f);
+	model[1] = glm::vec4(-dir.y, dir.x, 0.0f, 0.0f);
+	model[3] = glm::vec4(p1, 0.0f, 1.0f);
 
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	draw(line_VAO, GL_LINES, 2, model, color);
 }
 void BasicRenderer::initLineBuffers()
 {
 	glGenBuffers(1, &line_VBO);
 	glGenVertexArrays(1, &line_VAO);
 
+	float vertices[4] = { 0.0f, 0.0f, 1.0f, 0.0f };
 	glBindBuffer(GL_ARRAY_BUFFER, line_VBO);
-	glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float), nullptr, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
 	glBindVertexArray(line_VAO);
 	glEnableVertexAttribArray(0);
@@ -183,32 +210,21 @@ void BasicRenderer::initShape(br_Shape shape)
 }
 void BasicRenderer::RenderClosedPolygon(const std::vector<glm::vec2>& points, glm::vec2 position, glm::vec2 scale_points, glm::vec3 color)
 {
-	// Create VBO and copy data to it.
-	unsigned int VBO, VAO;
-	glGenVertexArrays(1, &VAO);
-
-	glGenBuffers(1, &VBO);
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(glm::vec2), points.data(), GL_DYNAMIC_DRAW);
-
-	glBindVertexArray(VAO);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-
 	glm::mat4 model(1.0f);	
 	model = glm::translate(model, glm::vec3(position, 0.0f));	
 	model = glm::scale(model, glm::vec3(scale_points, 0.0f));
 
-	this->shader.Use().SetMat4("model", model);
-	this->shader.SetVec3f("color", color);
-
-	glDrawArrays(GL_LINE_LOOP, 0, (int)points.size());
-
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glDeleteBuffers(1, &VBO);
-	glDeleteVertexArrays(1, &VAO);
+	RenderClosedPolygon(points, model, color);
 }
 void BasicRenderer::RenderClosedPolygon(const std::vector<glm::vec2>& points, glm::mat4 customModel, glm::vec3 color)
+{
+	// Polygon creates its own buffers, so the queue gets a copy of the points.
+	if (p_queue)
+		p_queue->SubmitCallback(queue_key, [this, points, customModel, color] { drawPolygon(points, customModel, color); });
+	else
+		drawPolygon(points, customModel, color);
+}
+void BasicRenderer::drawPolygon(const std::vector<glm::vec2>& points, const glm::mat4& model, glm::vec3 color)
 {
 	// Create VBO and copy data to it.
 	unsigned int VBO, VAO;
@@ -222,7 +238,7 @@ void BasicRenderer::RenderClosedPolygon(const std::vector<glm::vec2>& points, gl
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
 
-	this->shader.Use().SetMat4("model", customModel);
+	this->shader.Use().SetMat4("model", model);
 	this->shader.SetVec3f("color", color);
 
 	glDrawArrays(GL_LINE_LOOP, 0, (int)points.size());
@@ -32,12 +32,20 @@ uint32_t getShaderDataTypeSize(ShaderDataType type)
         case ShaderDataType::vec4:  return 4 * 4;
         case ShaderDataType::mat3:  return 3 * 3 * 4;
         case ShaderDataType::mat4:  return 4 * 4 * 4;
+        case ShaderDataType::ubyte4: return 4 * 1;
         default: break;
     }
 
     REN_ERR_LOG("Uknown shader data type");
     return 0;
 }
+uint32_t getShaderDataTypeComponentCount(ShaderDataType type)
+{
+    // All other types have 4 bytes per component.
+    if (type == ShaderDataType::ubyte4)
+        return 4;
+    return getShaderDataTypeSize(type) / 4;
+}
 uint32_t shaderDataTypeToOpenGL(ShaderDataType type)
 {
     switch (type)
@@ -52,6 +60,7 @@ uint32_t shaderDataTypeToOpenGL(ShaderDataType type)
         case ShaderDataType::vec2:  return GL_FLOAT;
         case ShaderDataType::vec3:  return GL_FLOAT;
         case ShaderDataType::vec4:  return GL_FLOAT;
+        case ShaderDataType::ubyte4: return GL_UNSIGNED_BYTE;
         default: break;
     }
 
@@ -70,7 +79,7 @@ BufferElement::BufferElement(uint8_t index, ShaderDataType type, std::string nam
     , normalized(normalized)
     , offset(0)
     , size(getShaderDataTypeSize(type))
-    , componentCount(size / 4)
+    , componentCount(getShaderDataTypeComponentCount(type))
     , GLType(shaderDataTypeToOpenGL(type))
     , index(index)
 {}
@@ -100,6 +109,7 @@ Ref<VertexBuffer> VertexBuffer::Create(float* vertices, size_t size, BufferUsage
 }
 VertexBuffer::VertexBuffer(float* vertices, size_t size, BufferUsage usage)
     : mSize(size)
+    , mUsage(usage)
 {
     glGenBuffers(1, &mID);
     glBindBuffer(GL_ARRAY_BUFFER, mID);
@@ -120,12 +130,34 @@ void VertexBuffer::Unbind()
 }
 void VertexBuffer::UpdateData(uint32_t offset, uint32_t size, float* vertices) const
 {
-    REN_ASSERT(offset + size < mSize, "Update request is reaching out of the buffer.");
+    REN_ASSERT(offset + size <= mSize, "Update request is reaching out of the buffer.");
 
     glBindBuffer(GL_ARRAY_BUFFER, mID);
     glBufferSubData(GL_ARRAY_BUFFER, offset, size, vertices);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
+void* VertexBuffer::Map(uint32_t offset, uint32_t size, bool unsynchronized)
+{
+    REN_ASSERT(offset + size <= mSize, "Map request is reaching out of the buffer.");
+
+    glBindBuffer(GL_ARRAY_BUFFER, mID);
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | (unsynchronized ? GL_MAP_UNSYNCHRONIZED_BIT : 0);
+    return glMapBufferRange(GL_ARRAY_BUFFER, offset, size, access);
+}
+void VertexBuffer::Unmap()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, mID);
+    if (glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE)
+        REN_ERR_LOG("Vertex buffer data store was corrupted while mapped.");
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+void VertexBuffer::Orphan(size_t size)
+{
+    mSize = size;
+    glBindBuffer(GL_ARRAY_BUFFER, mID);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, getGLBufferUsage(mUsage));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
 
 
@@ -133,13 +165,14 @@ void VertexBuffer::UpdateData(uint32_t offset, uint32_t size, float* vertices) c
 // Index buffer
 // ====================
 
-Ref<ElementBuffer> ElementBuffer::Create(uint32_t* indexes, size_t size, BufferUsage usage)
+Ref<ElementBuffer> ElementBuffer::Create(const void* indexes, size_t size, BufferUsage usage, IndexType type)
 {
-    return Ref<ElementBuffer>(new ElementBuffer(indexes, size, usage));
+    return Ref<ElementBuffer>(new ElementBuffer(indexes, size, usage, type));
 }
-ElementBuffer::ElementBuffer(uint32_t* indexes, size_t size, BufferUsage usage)
-    : mSize(size), mElementCount(size / sizeof(uint32_t))
+ElementBuffer::ElementBuffer(const void* indexes, size_t size, BufferUsage usage, IndexType type)
+    : mSize(size), mUsage(usage), mIndexType(type)
 {
+    mElementCount = size / indexSize();
     glGenBuffers(1, &mID);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mID);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indexes, getGLBufferUsage(usage));
@@ -159,9 +192,13 @@ void ElementBuffer::Unbind()
 }
 void ElementBuffer::UpdateData(uint32_t offset, uint32_t size, uint32_t* indices) const
 {
-    REN_ASSERT(offset + size < mSize, "Update request is reaching out of the buffer.");
+    REN_ASSERT(offset + size <= mSize, "Update request is reaching out of the buffer.");
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mID);
     glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset, size, indices);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
+uint32_t ElementBuffer::GetGLIndexType() const
+{
+    return mIndexType == IndexType::UInt16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
@@ -29,7 +29,15 @@ void RenderAPI::DrawArrays(const Ref<VertexArray>& vao, uint32_t first, uint32_t
 }
 void RenderAPI::DrawElements(const Ref<VertexArray>& vao, uint32_t count)
 {
-    glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, 0);
+    glDrawElements(GL_TRIANGLES, count, vao->GetElementBuffer()->GetGLIndexType(), 0);
+}
+void RenderAPI::DrawElementsBaseVertex(const Ref<VertexArray>& vao, uint32_t count, uint32_t index_offset, int32_t base_vertex)
+{
+    glDrawElementsBaseVertex(GL_TRIANGLES, count, vao->GetElementBuffer()->GetGLIndexType(), (const void*)uintptr_t(index_offset), base_vertex);
+}
+void RenderAPI::DrawElementsInstanced(const Ref<VertexArray>& vao, uint32_t count, uint32_t instance_count)
+{
+    glDrawElementsInstanced(GL_TRIANGLES, count, vao->GetElementBuffer()->GetGLIndexType(), 0, instance_count);
 }
 void RenderAPI::Draw(const Ref<VertexArray>& vao, uint32_t count)
 {
@@ -42,6 +50,12 @@ void RenderAPI::SetActiveTextureUnit(uint32_t unit)
 {
     glActiveTexture(GL_TEXTURE0 + unit);
 }
+uint32_t RenderAPI::GetMaxTextureUnits()
+{
+    GLint units = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+    return uint32_t(units);
+}
 void RenderAPI::WireframeRender(bool b)
 {
     glPolygonMode(GL_FRONT_AND_BACK, b ? GL_LINE : GL_FILL);
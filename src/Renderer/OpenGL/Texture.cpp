@@ -71,18 +71,18 @@ void Texture2D::Generate(unsigned int width, unsigned int height, unsigned char*
 }
 Texture2D& Texture2D::UpdateParameters()
 {
-	glBindTexture(GL_TEXTURE_2D, this->ID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, Wrap_S);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, Wrap_T);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Filter_min);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Filter_mag);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(BindTarget, this->ID);
+	glTexParameteri(BindTarget, GL_TEXTURE_WRAP_S, Wrap_S);
+	glTexParameteri(BindTarget, GL_TEXTURE_WRAP_T, Wrap_T);
+	glTexParameteri(BindTarget, GL_TEXTURE_MIN_FILTER, Filter_min);
+	glTexParameteri(BindTarget, GL_TEXTURE_MAG_FILTER, Filter_mag);
+	glBindTexture(BindTarget, 0);
 	return *this;
 }
 
 void Texture2D::Bind() const
 {
-	glBindTexture(GL_TEXTURE_2D, this->ID);
+	glBindTexture(BindTarget, this->ID);
 }
 
 Texture2D& Texture2D::Resize(int new_width, int new_height)
@@ -133,6 +133,7 @@ TextureBatch::TextureBatch()
 {
 	glGetIntegerv(GL_MAX_TEXTURE_SIZE, (GLint*)&mMaxTextureWidth);
 	mMaxTextureHeight = mMaxTextureWidth;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, (GLint*)&mMaxPages);
 	Width = 0;
 	Height = 0;
 	Filter_mag = GL_NEAREST;
@@ -183,6 +184,27 @@ bool TextureBatch::insertToLayerAndSetOffset(uint32_t n_layer, const prebuf_elem
 	return true;
 }
 
+bool TextureBatch::insertTexture(const prebuf_elem& elem)
+{
+	if (insertToLayerAndSetOffset(0, elem))
+	{
+		mTextureDescriptors[elem.desc_i].page = mPageCount - 1;
+		return true;
+	}
+	// Opening new page helps only if the texture fits into an empty one.
+	const TextureDescriptor& desc = mTextureDescriptors[elem.desc_i];
+	bool fits_empty_page = uint32_t(desc.size.x + 2 * mTextureMargin) <= mMaxTextureHeight && uint32_t(desc.size.y + 2 * mTextureMargin) <= mMaxTextureHeight;
+	if (!UseTextureArray || mLayers.empty() || !fits_empty_page || mPageCount == mMaxPages)
+		return false;
+
+	// Close the current page and start new one.
+	mPagesHeight = std::max(mPagesHeight, mLayers.back().top_offset + mLayers.back().height);
+	for (auto&& l : mLayers)
+		mPagesWidth = std::max(mPagesWidth, l.current_width);
+	mLayers.clear();
+	mPageCount++;
+	return insertTexture(elem);
+}
 int32_t TextureBatch::AddTexture(const RawTexture& texture)
 {
 	REN_ASSERT(texture.channel_count != 0, "Cannot add texture to batch if the channel count isn't specified.");
@@ -209,7 +231,7 @@ int32_t TextureBatch::AddTexture(const RawTexture& texture)
 	// Perform insertion check.
 	if (!SortBySize) 
 	{
-		if (insertToLayerAndSetOffset(0, mPrebuffer.back())) 
+		if (insertTexture(mPrebuffer.back())) 
 		{
 			mDirty = true;
 			return desc.descriptor_id;
@@ -259,20 +281,21 @@ void TextureBatch::Build()
 		// Create layered structure.
 		for (auto&& elem : mPrebuffer) 
 		{
-			bool success = insertToLayerAndSetOffset(0, elem);
+			bool success = insertTexture(elem);
 			if (!success)
 				LOG_E("Could not add texture to batch!");
 		}
 	}
 	
-	// Get batch texture dimensions.
-	Height = mLayers.back().top_offset + mLayers.back().height;
+	// Get batch texture dimensions. All pages have the size of the largest one.
+	Height = std::max(mPagesHeight, mLayers.back().top_offset + mLayers.back().height);
+	Width = mPagesWidth;
 	for (auto&& i : mLayers)
 		Width = std::max(Width, i.current_width);
 
 	// Allocate space for batch texture, which will later be copied to GPU memory.
-	mBuffer = new uint8_t[Width * Height * ChannelCount];
-	std::memset(mBuffer, 0, Width * Height * ChannelCount);
+	mBuffer = new uint8_t[Width * Height * ChannelCount * mPageCount];
+	std::memset(mBuffer, 0, Width * Height * ChannelCount * mPageCount);
 
 	// Copy each prebuffered texture pixel into its correct position in buffer.
 	for (auto&& e : mPrebuffer)
@@ -287,7 +310,7 @@ void TextureBatch::Build()
 			local_x = i % local_width;
 			local_y = i / local_width;
 
-			buf_offset = (desc.offset.y + local_y) * Width + (desc.offset.x + local_x);
+			buf_offset = (desc.page * Height + desc.offset.y + local_y) * Width + (desc.offset.x + local_x);
 
 			std::memset(&mBuffer[buf_offset * ChannelCount], 0, ChannelCount);
 			if (ChannelCount == 4)
@@ -297,7 +320,7 @@ void TextureBatch::Build()
 		
 		// Create border from margin spacing.
 		for (int i = 0; i < mTextureMargin; i++)
-			createBorder(desc.offset - glm::ivec2(i), desc.size + 2 * glm::ivec2(i));
+			createBorder(desc.offset - glm::ivec2(i), desc.size + 2 * glm::ivec2(i), desc.page);
 
 		delete[] e.data_copy;
 
@@ -316,16 +339,33 @@ void TextureBatch::Build()
 	Internal_format = Image_format;
 	// Disable byte alignment restriction.
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	Generate(Width, Height, mBuffer);
+	if (UseTextureArray)
+		generateArray(mBuffer);
+	else
+		Generate(Width, Height, mBuffer);
 	delete[] mBuffer;
 
 	mCreated = true;
 	mDirty = false;
 }
 
-void TextureBatch::createBorder(glm::ivec2 offset, glm::ivec2 size)
+void TextureBatch::generateArray(unsigned char* data)
 {
-	const auto& buf = [&](const glm::ivec2& pos) { return (pos.y * Width + pos.x) * ChannelCount; };
+	BindTarget = GL_TEXTURE_2D_ARRAY;
+	glGenTextures(1, &this->ID);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, this->ID);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, Internal_format, Width, Height, mPageCount, 0, Image_format, GL_UNSIGNED_BYTE, data);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, Wrap_S);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, Wrap_T);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, Filter_min);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, Filter_mag);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+void TextureBatch::createBorder(glm::ivec2 offset, glm::ivec2 size, int32_t page)
+{
+	const auto& buf = [&](const glm::ivec2& pos) { return ((page * Height + pos.y) * Width + pos.x) * ChannelCount; };
 
 	// Copy top edge
 	std::memcpy(&mBuffer[buf(offset - glm::ivec2(0, 1))], &mBuffer[buf(offset)], size.x * ChannelCount);
@@ -355,7 +395,18 @@ void TextureBatch::Renew()
 		return;
 
 	// Copy texture from GPU memory to RAM and delete the GL texture.
-	RawTexture tex = Utils::GLToRawTexture(*(dynamic_cast<Texture2D*>(this)));
+	RawTexture tex;
+	if (UseTextureArray)
+	{
+		// All pages are read at once, they follow each other in the memory.
+		tex.data = new uint8_t[Width * Height * ChannelCount * mPageCount];
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, ID);
+		glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, Image_format, GL_UNSIGNED_BYTE, tex.data);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+	else
+		tex = Utils::GLToRawTexture(*(dynamic_cast<Texture2D*>(this)));
 	this->Delete();		// Delete the texture in GPU memory.
 
 	// Create prebuffer elements from descriptors.
@@ -372,14 +423,20 @@ void TextureBatch::Renew()
 		for (uint32_t i = 0; i < e.size; i++)
 		{
 			uint32_t pixel_x = desc.offset.x + (i % desc.size.x);
-			uint32_t pixel_y = desc.offset.y + (i / desc.size.x);
-			std::memcpy(&e.data_copy[i * ChannelCount], &tex.data[(pixel_y * desc.size.x + pixel_x) * ChannelCount], ChannelCount);
+			uint32_t pixel_y = desc.page * Height + desc.offset.y + (i / desc.size.x);
+			std::memcpy(&e.data_copy[i * ChannelCount], &tex.data[(pixel_y * Width + pixel_x) * ChannelCount], ChannelCount);
 		}
 		mPrebuffer.push_back(e);
 	}
 
-	// Re-build the batch.
-	delete tex.data;
+	// Re-build the batch. Sorted batch inserts all textures again, so it starts with an empty layout.
+	delete[] tex.data;
+	if (SortBySize)
+	{
+		mLayers.clear();
+		mPageCount = 1;
+		mPagesWidth = mPagesHeight = 0;
+	}
 	mCreated = false;
 	Build();
 }
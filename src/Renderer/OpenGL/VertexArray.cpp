@@ -32,12 +32,13 @@ VertexArray& VertexArray::AddVertexBuffer(const Ref<VertexBuffer>& buf)
     glBindVertexArray(mID);
     buf->Bind();
 
-    auto& layout = buf->GetLayout();
     for (auto&& elem : buf->GetLayout())
     {
         glEnableVertexAttribArray(elem.index);
-        glVertexAttribPointer(elem.index, elem.componentCount, elem.GLType, elem.normalized ? GL_TRUE : GL_FALSE, layout.GetStrideSize(), (const void*)uintptr_t(elem.offset));
+        if (buf->GetDivisor() != 0)
+            glVertexAttribDivisor(elem.index, buf->GetDivisor());
     }
+    setAttributePointers(*buf, 0);
 
     mVertexBuffers.push_back(buf);
 
@@ -55,4 +56,15 @@ VertexArray& VertexArray::SetElementBuffer(const Ref<ElementBuffer>& buf)
     glBindVertexArray(0);
 
     return *this;
+}
+void VertexArray::SetVertexBufferOffset(uint32_t buffer_i, size_t offset)
+{
+    mVertexBuffers[buffer_i]->Bind();
+    setAttributePointers(*mVertexBuffers[buffer_i], offset);
+}
+void VertexArray::setAttributePointers(VertexBuffer& buf, size_t offset)
+{
+    auto& layout = buf.GetLayout();
+    for (auto&& elem : layout)
+        glVertexAttribPointer(elem.index, elem.componentCount, elem.GLType, elem.normalized ? GL_TRUE : GL_FALSE, layout.GetStrideSize(), (const void*)uintptr_t(offset + elem.offset));
 }
\ No newline at end of file
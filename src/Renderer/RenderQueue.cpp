@@ -0,0 +1,90 @@
+#include "Ren/Renderer/RenderQueue.h"
+#include "Ren/Renderer/OpenGL/RenderAPI.h"
+#include <glad/glad.h>
+#include <numeric>      // std::iota
+
+using namespace Ren;
+
+void RenderQueue::Submit(uint64_t key, const DrawCommand& draw)
+{
+    push(key).draw = draw;
+}
+void RenderQueue::Submit(uint64_t key, const Ref<VertexArray>& vao, const DrawCommand& draw)
+{
+    command& cmd = push(key);
+    cmd.draw = draw;
+    cmd.vertex_array = uint32_t(mVertexArrays.size());
+    mVertexArrays.push_back(vao);
+}
+void RenderQueue::SubmitCallback(uint64_t key, std::function<void()> func)
+{
+    push(key).callback = uint32_t(mCallbacks.size());
+    mCallbacks.push_back(std::move(func));
+}
+void RenderQueue::Flush()
+{
+    mStats = Stats();
+    mStats.commands = uint32_t(mCommands.size());
+    if (mCommands.empty())
+        return;
+
+    mOrder.resize(mCommands.size());
+    std::iota(mOrder.begin(), mOrder.end(), 0);
+    std::stable_sort(mOrder.begin(), mOrder.end(), [this](uint32_t a, uint32_t b) { return mCommands[a].key < mCommands[b].key; });
+
+    // State set by the previous commands. NONE forces the next command to set it.
+    uint32_t shader = NONE, vao = NONE, texture = NONE, texture_target = NONE;
+    Shader current_shader;
+    for (uint32_t i : mOrder)
+    {
+        const command& cmd = mCommands[i];
+        if (cmd.callback != NONE)
+        {
+            mCallbacks[cmd.callback]();
+            shader = vao = texture = texture_target = NONE;
+            mStats.callbacks++;
+            continue;
+        }
+
+        if (cmd.draw.shader != shader)
+        {
+            shader = current_shader.ID = cmd.draw.shader;
+            current_shader.Use();
+            mStats.shader_changes++;
+        }
+        const Ref<VertexArray>* p_vertex_array = cmd.vertex_array != NONE ? &mVertexArrays[cmd.vertex_array] : nullptr;
+        uint32_t cmd_vao = p_vertex_array ? (*p_vertex_array)->GetID() : cmd.draw.vao;
+        if (cmd_vao != vao)
+        {
+            vao = cmd_vao;
+            glBindVertexArray(vao);
+            mStats.vertex_array_changes++;
+        }
+        if (cmd.draw.texture != 0 && (cmd.draw.texture != texture || cmd.draw.texture_target != texture_target))
+        {
+            // Callbacks can leave any unit active.
+            if (texture == NONE)
+                RenderAPI::SetActiveTextureUnit(0);
+            texture = cmd.draw.texture;
+            texture_target = cmd.draw.texture_target;
+            glBindTexture(texture_target, texture);
+            mStats.texture_changes++;
+        }
+        if (cmd.apply)
+            cmd.apply(current_shader, mUniforms.data() + cmd.uniforms);
+
+        if (p_vertex_array)
+            RenderAPI::Draw(*p_vertex_array, cmd.draw.count);
+        else
+            glDrawArrays(cmd.draw.mode, cmd.draw.first, cmd.draw.count);
+    }
+    glBindVertexArray(0);
+    Clear();
+}
+void RenderQueue::Clear()
+{
+    mCommands.clear();
+    mUniforms.clear();
+    mVertexArrays.clear();
+    mCallbacks.clear();
+}
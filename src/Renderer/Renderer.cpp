@@ -1,26 +1,55 @@
 #include "Ren/Renderer/Renderer.h"
 #include "Ren/ResourceManager.h"
 #include <algorithm>
+#include <cmath>
+#include <utility>
+#if !defined(REN_DISABLE_SIMD) && (defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64))
+    #include <immintrin.h>
+#endif
 #define RESOURCE_GROUP "__renderer"
 
 using namespace Ren;
 
 void Renderer::BeginScene()
 {
+    msQueue.Clear();
+    msInScene = true;
 }
 void Renderer::EndScene()
 {
+    msInScene = false;
+    msQueue.Flush();
 }
 void Renderer::Submit(const Ref<VertexArray>& vao)
 {
     vao->Bind();
     RenderAPI::Draw(vao);
 }
+void Renderer::Submit(const Ref<VertexArray>& vao, const Shader& shader, uint64_t key, const Texture2D* p_texture)
+{
+    if (msInScene)
+    {
+        msQueue.Submit(key, vao, getDrawCommand(shader, p_texture));
+        return;
+    }
+    shader.Use();
+    draw(vao, p_texture);
+}
+void Renderer::draw(const Ref<VertexArray>& vao, const Texture2D* p_texture)
+{
+    if (p_texture)
+    {
+        RenderAPI::SetActiveTextureUnit(0);
+        p_texture->Bind();
+    }
+    vao->Bind();
+    RenderAPI::Draw(vao);
+}
 
 //////////////////////////////////////
 //////////// Renderer2D //////////////
 //////////////////////////////////////
-glm::mat4 Renderer2D::Transform::getModelMatrix()
+glm::mat4 Renderer2D::Transform::getModelMatrix() const
 {
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::translate(model, glm::vec3(position, 0.0));
@@ -31,10 +60,89 @@ glm::mat4 Renderer2D::Transform::getModelMatrix()
 
     return model;
 }
+namespace
+{
+    // Quads are transformed in groups of this many. AVX2 processes the whole group at once, SSE in two halves.
+    constexpr uint32_t QUAD_LANES = 8;
+    // Structure of arrays of QUAD_LANES quads. Half size and center are those of the scaled quad.
+    struct quad_lanes {
+        alignas(32) float cx[QUAD_LANES], cy[QUAD_LANES];
+        alignas(32) float hx[QUAD_LANES], hy[QUAD_LANES];
+        alignas(32) float sin[QUAD_LANES], cos[QUAD_LANES];
+    };
+    // x[c][q] is x coordinate of corner c of the quad q. Corners are in the order (0, 0), (0, 1), (1, 0), (1, 1) of the unit quad.
+    struct corner_lanes {
+        alignas(32) float x[4][QUAD_LANES], y[4][QUAD_LANES];
+    };
+
+    // Same transformation as Renderer2D::Transform::getModelMatrix(), but without building the matrix.
+    // Quad is rotated around its center, so corner = center + R * (+-hx, +-hy), where R rotates by -rotation.
+    // - a = cos * hx, b = sin * hy, c = sin * hx, d = cos * hy
+    // - (0, 0): (cx - a + b, cy - c - d)    (0, 1): (cx - a - b, cy - c + d)
+    // - (1, 0): (cx + a + b, cy + c - d)    (1, 1): (cx + a - b, cy + c + d)
+#if !defined(REN_DISABLE_SIMD) && defined(__AVX2__)
+    inline void computeCorners(const quad_lanes& in, corner_lanes& out)
+    {
+        __m256 cx = _mm256_load_ps(in.cx), cy = _mm256_load_ps(in.cy);
+        __m256 hx = _mm256_load_ps(in.hx), hy = _mm256_load_ps(in.hy);
+        __m256 sin = _mm256_load_ps(in.sin), cos = _mm256_load_ps(in.cos);
+        __m256 a = _mm256_mul_ps(cos, hx), b = _mm256_mul_ps(sin, hy);
+        __m256 c = _mm256_mul_ps(sin, hx), d = _mm256_mul_ps(cos, hy);
+        __m256 left = _mm256_sub_ps(cx, a), right = _mm256_add_ps(cx, a);
+        __m256 bottom = _mm256_sub_ps(cy, c), top = _mm256_add_ps(cy, c);
+        _mm256_store_ps(out.x[0], _mm256_add_ps(left, b));   _mm256_store_ps(out.y[0], _mm256_sub_ps(bottom, d));
+        _mm256_store_ps(out.x[1], _mm256_sub_ps(left, b));   _mm256_store_ps(out.y[1], _mm256_add_ps(bottom, d));
+        _mm256_store_ps(out.x[2], _mm256_add_ps(right, b));  _mm256_store_ps(out.y[2], _mm256_sub_ps(top, d));
+        _mm256_store_ps(out.x[3], _mm256_sub_ps(right, b));  _mm256_store_ps(out.y[3], _mm256_add_ps(top, d));
+    }
+#elif !defined(REN_DISABLE_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+    inline void computeCorners(const quad_lanes& in, corner_lanes& out)
+    {
+        for (uint32_t q = 0; q < QUAD_LANES; q += 4)
+        {
+            __m128 cx = _mm_load_ps(in.cx + q), cy = _mm_load_ps(in.cy + q);
+            __m128 hx = _mm_load_ps(in.hx + q), hy = _mm_load_ps(in.hy + q);
+            __m128 sin = _mm_load_ps(in.sin + q), cos = _mm_load_ps(in.cos + q);
+            __m128 a = _mm_mul_ps(cos, hx), b = _mm_mul_ps(sin, hy);
+            __m128 c = _mm_mul_ps(sin, hx), d = _mm_mul_ps(cos, hy);
+            __m128 left = _mm_sub_ps(cx, a), right = _mm_add_ps(cx, a);
+            __m128 bottom = _mm_sub_ps(cy, c), top = _mm_add_ps(cy, c);
+            _mm_store_ps(out.x[0] + q, _mm_add_ps(left, b));   _mm_store_ps(out.y[0] + q, _mm_sub_ps(bottom, d));
+            _mm_store_ps(out.x[1] + q, _mm_sub_ps(left, b));   _mm_store_ps(out.y[1] + q, _mm_add_ps(bottom, d));
+            _mm_store_ps(out.x[2] + q, _mm_add_ps(right, b));  _mm_store_ps(out.y[2] + q, _mm_sub_ps(top, d));
+            _mm_store_ps(out.x[3] + q, _mm_sub_ps(right, b));  _mm_store_ps(out.y[3] + q, _mm_add_ps(top, d));
+        }
+    }
+#else
+    inline void computeCorners(const quad_lanes& in, corner_lanes& out)
+    {
+        for (uint32_t q = 0; q < QUAD_LANES; q++)
+        {
+            float a = in.cos[q] * in.hx[q], b = in.sin[q] * in.hy[q];
+            float c = in.sin[q] * in.hx[q], d = in.cos[q] * in.hy[q];
+            out.x[0][q] = in.cx[q] - a + b;  out.y[0][q] = in.cy[q] - c - d;
+            out.x[1][q] = in.cx[q] - a - b;  out.y[1][q] = in.cy[q] - c + d;
+            out.x[2][q] = in.cx[q] + a + b;  out.y[2][q] = in.cy[q] + c - d;
+            out.x[3][q] = in.cx[q] + a - b;  out.y[3][q] = in.cy[q] + c + d;
+        }
+    }
+#endif
+}
 Renderer2D::Renderer2D()
+    : mSubmissionBuffers(new PerThread<frame_vector<QuadSubmission>>(ThreadPool::Get()))
 {
     auto vbo = VertexBuffer::Create(NULL, mVBOSize, BufferUsage::DynamicDraw);
-    auto ebo = ElementBuffer::Create(NULL, mEBOSize, BufferUsage::DynamicDraw);
+
+    // Indices of all quads are the same, so they are generated only once, for the largest group.
+    // Groups are drawn with base vertex pointing to their first vertex.
+    std::vector<uint16_t> quad_indices(mMaxGroupQuads * 6);
+    for (uint32_t quad = 0; quad < mMaxGroupQuads; quad++)
+    {
+        const uint16_t first = uint16_t(quad * 4);
+        const uint16_t indices[6] = { first, uint16_t(first + 1), uint16_t(first + 2), uint16_t(first + 1), uint16_t(first + 2), uint16_t(first + 3) };
+        std::copy(indices, indices + 6, quad_indices.begin() + quad * 6);
+    }
+    auto ebo = ElementBuffer::Create(quad_indices.data(), quad_indices.size() * sizeof(uint16_t), BufferUsage::StaticDraw, IndexType::UInt16);
     vbo->SetLayout({
         { 0, ShaderDataType::vec3, "aPosition" },
         { 1, ShaderDataType::vec2, "aTexCoords" },
@@ -44,12 +152,36 @@ Renderer2D::Renderer2D()
     mQuadVAO = VertexArray::Create();
     mQuadVAO->AddVertexBuffer(vbo).SetElementBuffer(ebo);
 
-    mShader = ResourceManager::LoadShader(ENGINE_SHADERS_DIR "renderer2d.glsl", RESOURCE_GROUP);
-    mShader.Use();
-    for (uint32_t i = 0; i < 12; i++)
-        mShader.SetInt(("uTextures[" + std::to_string(i) + "]").c_str(), i);
+    // Instanced path draws every quad as instance of the unit quad, so it uses only the first 6 indices.
+    const float corners[8] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f, 1.0f };
+    auto corner_vbo = VertexBuffer::Create((float*)corners, sizeof(corners), BufferUsage::StaticDraw);
+    corner_vbo->SetLayout({ { 0, ShaderDataType::vec2, "aCorner" } });
+    auto instance_vbo = VertexBuffer::Create(NULL, mMaxQuads * sizeof(QuadInstance), BufferUsage::DynamicDraw);
+    instance_vbo->SetLayout({
+        { 1, ShaderDataType::vec2, "aPosition" },
+        { 2, ShaderDataType::vec2, "aScale" },
+        { 3, ShaderDataType::Float, "aRotation" },
+        { 4, ShaderDataType::vec4, "aUVRect" },
+        { 5, ShaderDataType::Float, "aTexIndex" },
+        { 6, ShaderDataType::ubyte4, "aColor", true }
+    });
+    instance_vbo->SetDivisor(1);
+    mInstanceVAO = VertexArray::Create();
+    mInstanceVAO->AddVertexBuffer(corner_vbo).AddVertexBuffer(instance_vbo).SetElementBuffer(ebo);
 
-    mpBuffer = std::malloc(mVBOSize);
+    mShader = ResourceManager::LoadShader(ENGINE_SHADERS_DIR "renderer2d.glsl", RESOURCE_GROUP);
+    mInstancedShader = ResourceManager::LoadShader(ENGINE_SHADERS_DIR "renderer2d_instanced.glsl", RESOURCE_GROUP "_instanced");
+    mArrayShader = ResourceManager::LoadShader(ENGINE_SHADERS_DIR "renderer2d_array.glsl", RESOURCE_GROUP "_array");
+    mInstancedArrayShader = ResourceManager::LoadShader(ENGINE_SHADERS_DIR "renderer2d_instanced_array.glsl", RESOURCE_GROUP "_instanced_array");
+    mMaxTextureUnits = std::clamp(RenderAPI::GetMaxTextureUnits(), 1u, SHADER_TEXTURE_SLOTS);
+    for (Shader* shader : { &mShader, &mInstancedShader })
+    {
+        shader->Use();
+        for (uint32_t i = 0; i < SHADER_TEXTURE_SLOTS; i++)
+            shader->SetInt(("uTextures[" + std::to_string(i) + "]").c_str(), i);
+    }
+    for (Shader* shader : { &mArrayShader, &mInstancedArrayShader })
+        shader->Use().SetInt("uTextureArray", 0);
 }
 Renderer2D* Renderer2D::GetInstance()
 {
@@ -62,7 +194,7 @@ void Renderer2D::DeleteInstance()
     if (msInstance)
     {
         msInstance->mQuadVAO.reset();   // Delete VAO early, as this is static object, so it could be freed too late and seg fault.
-        std::free(msInstance->mpBuffer);
+        msInstance->mInstanceVAO.reset();
         delete msInstance;
         msInstance = nullptr;
     }
@@ -72,186 +204,976 @@ void Renderer2D::BeginScene(Camera2D* camera)
     REN_ASSERT(!mPreparing, "Cannot begin scene when still preparing.");
 
     mPV = camera->GetPVMat();
+    mVisibleBounds = camera->GetVisibleBounds();
     mPrimitives.clear();
     mRenderGroups.clear();
+    mFrameAllocationStart = msAllocationCount;
 }
 void Renderer2D::EndScene() 
 {
 }
-void Renderer2D::SubmitQuad(const Transform& trans, const Material& mat, int32_t layer)
+void Renderer2D::SubmitQuad(const Transform& trans, const Material& mat, int32_t layer, uint32_t order)
 {
-    mQuadSubmissions.push_back({ trans, mat, layer });
+    mSubmissionBuffers->Local().push_back({ trans, mat, layer, order });
+}
+void Renderer2D::SubmitQuads(const QuadSubmission* p_quads, size_t count)
+{
+    auto& buffer = mSubmissionBuffers->Local();
+    buffer.insert(buffer.end(), p_quads, p_quads + count);
+}
+void Renderer2D::SetThreadPool(ThreadPool* p_pool)
+{
+    // Keep the quads submitted so far.
+    mergeSubmissions();
+    mpThreadPool = p_pool;
+    mSubmissionBuffers.reset(new PerThread<frame_vector<QuadSubmission>>(mpThreadPool ? *mpThreadPool : ThreadPool::Get()));
+}
+void Renderer2D::Render(RenderQueue& queue, uint32_t pass)
+{
+    // Draws of the previous recording were executed by the flush.
+    mQueuedDraws.clear();
+    mQueuedBatches.clear();
+    mpQueue = &queue;
+    mQueuePass = pass;
+    Render();
+    mpQueue = nullptr;
 }
 void Renderer2D::Render()
 {
-    if (mQuadSubmissions.size() == 0)
+    mergeSubmissions();
+    if (mQuadSubmissions.size() == 0 && mStaticLayers.empty() && mSpriteBuckets.empty())
+    {
+        // Nothing is drawn, so the stats of the previous frame must not stay.
+        mStats = Stats();
+        mStats.allocations = msAllocationCount - mFrameAllocationStart;
         return;
+    }
+    if (!mStaticLayers.empty())
+    {
+        splitStaticSubmissions();
+        if (mStaticSubmissions.size() != 0)
+            buildStaticLayers();
+    }
+    uploadSprites();
+    batchPrimitives();
+    mTextureUnitSplits = 0;
+    mStaticDrawCalls = 0;
+    mStaticQuadCount = 0;
+    mSpriteDrawCount = 0;
+    // Everything can be culled.
+    if (mPrimitives.size() != 0)
+    {
+        groupByLayers();
+        groupByMaxTextures();
+        groupBySize();
+        collectGroupBatches();
+        if (mRenderPath == RenderPath::Instanced)
+            renderGroupsInstanced();
+        else
+            renderGroups();
+    }
+    else
+    {
+        int32_t bound[SHADER_TEXTURE_SLOTS];
+        std::fill_n(bound, SHADER_TEXTURE_SLOTS, -1);
+        retained_cursor cursor;
+        drawRetained(cursor, UINT32_MAX, bound);
+    }
+
+    mStats.quad_count = mPrimitives.size() + mStaticQuadCount + mSpriteCount;
+    mStats.static_quad_count = mStaticQuadCount;
+    mStats.sprite_count = mSpriteCount;
+    mStats.sprite_upload_ranges = mSpriteUploadRanges;
+    mStats.culled_count = mCulledCount;
+    mStats.draw_calls = mRenderGroups.size() + mStaticDrawCalls + mSpriteDrawCount;
+    mStats.texture_unit_splits = mTextureUnitSplits;
+    mStats.allocations = msAllocationCount - mFrameAllocationStart;
+}
+void Renderer2D::mergeSubmissions()
+{
+    // Buffers are appended in the order of threads. Which thread submitted which quad can differ between the runs,
+    // but the order of submissions is used only to break ties of the sort keys (see QuadSubmission::order).
+    for (auto&& buffer : *mSubmissionBuffers)
+    {
+        mQuadSubmissions.insert(mQuadSubmissions.end(), buffer.begin(), buffer.end());
+        buffer.clear();
+    }
+}
+void Renderer2D::batchPrimitives()
+{
+    // Create primitives from rendering submissions. Vertices (or instances) are written directly into the arena.
+    // Submissions are split into slices, which are culled and batched in parallel. Each worker writes only into its own part of the arena.
+    // TODO: optimizations like: merging vertices etc.
+    const uint32_t count = mQuadSubmissions.size();
+    buildSlices(count);
+    mVisibleSubmissions.resize(count);
+    runSlices([this](batch_slice& slice) { cullSlice(slice); });
+
+    // Visible quads of the slice are placed right after the visible quads of the previous slices.
+    uint32_t visible_count = 0;
+    for (auto&& slice : mSlices)
+    {
+        slice.offset = visible_count;
+        visible_count += slice.count;
+    }
+    mCulledCount = count - visible_count;
+
+    mPrimitives.resize(visible_count);
+    if (mRenderPath == RenderPath::Instanced)
+        mInstances.resize(visible_count);
+    else
+        mVertices.resize(visible_count * 4);
+
+    runSlices([this](const batch_slice& slice) { batchSlice(slice); });
+    mQuadSubmissions.clear();
+}
+void Renderer2D::splitStaticSubmissions()
+{
+    // Submissions keep their order, so the static quads are built in the same order as if they were dynamic.
+    uint32_t kept = 0;
+    for (uint32_t sub_i = 0; sub_i < mQuadSubmissions.size(); sub_i++)
+    {
+        const QuadSubmission& quad_sub = mQuadSubmissions[sub_i];
+        size_t static_i = findStaticLayer(quad_sub.layer);
+        if (static_i == mStaticLayers.size())
+            mQuadSubmissions[kept++] = quad_sub;
+        else if (!mStaticLayers[static_i].built)
+            mStaticSubmissions.push_back(quad_sub);
+    }
+    mQuadSubmissions.resize(kept);
+}
+void Renderer2D::buildStaticLayers()
+{
+    // Layers are marked as built first, so that groupByLayers() splits the groups between them.
+    for (auto&& quad_sub : mStaticSubmissions)
+        mStaticLayers[findStaticLayer(quad_sub.layer)].built = true;
+
+    // Static quads go through the same pipeline as the dynamic ones. They are not culled, as the camera can move,
+    // and they are always built as vertices, so that they don't have to be transformed again when drawn.
+    std::swap(mQuadSubmissions, mStaticSubmissions);
+    const RenderPath path = mRenderPath;
+    const bool culling = mCulling;
+    mRenderPath = RenderPath::Vertices;
+    mCulling = false;
     batchPrimitives();
     groupByLayers();
     groupByMaxTextures();
     groupBySize();
-    offsetIndices();
-    renderGroups();
+    collectGroupBatches();
+    mRenderPath = path;
+    mCulling = culling;
+    std::swap(mQuadSubmissions, mStaticSubmissions);
+
+    // Same texture indices as written by renderGroups().
+    const bool use_slots = mTextureMode == TextureMode::Atlases;
+    mStaticVertices.resize(mSortKeys.size() * 4);
+    for (uint32_t pos = 0; pos < mSortKeys.size(); pos++)
+    {
+        Vertex* p_dst = std::copy_n(&mVertices[primitiveAt(pos) * 4], 4, &mStaticVertices[pos * 4]) - 4;
+        if (use_slots)
+            for (int i = 0; i < 4; i++)
+                p_dst[i].tex_index = float(mTextureSlots[pos]);
+    }
+
+    // Groups don't span multiple static layers, so the consecutive groups of the same layer form its geometry.
+    for (size_t group_i = 0; group_i < mRenderGroups.size(); )
+    {
+        const uint32_t first = mRenderGroups[group_i].mPrimitives_start;
+        static_layer& layer = mStaticLayers[findStaticLayer(mPrimitives[primitiveAt(first)].layer)];
+        layer.groups.clear();
+        layer.batches.clear();
+        for (; group_i < mRenderGroups.size() && mPrimitives[primitiveAt(mRenderGroups[group_i].mPrimitives_start)].layer == layer.layer; group_i++)
+        {
+            render_group group = mRenderGroups[group_i];
+            auto p_batches = mGroupBatches.begin() + group.batches_start;
+            group.batches_start = layer.batches.size();
+            layer.batches.insert(layer.batches.end(), p_batches, p_batches + group.batches_count);
+            group.mPrimitives_start -= first;
+            group.mPrimitives_end -= first;
+            layer.groups.push_back(group);
+        }
+        layer.quad_count = layer.groups.back().mPrimitives_end + 1;
+
+        auto vbo = VertexBuffer::Create((float*)&mStaticVertices[first * 4], layer.quad_count * 4 * sizeof(Vertex), BufferUsage::StaticDraw);
+        vbo->SetLayout(mQuadVAO->GetVertexBuffers()[0]->GetLayout());
+        layer.vao = VertexArray::Create();
+        layer.vao->AddVertexBuffer(vbo).SetElementBuffer(mQuadVAO->GetElementBuffer());
+    }
+    mPrimitives.clear();
+    mRenderGroups.clear();
 }
-void Renderer2D::batchPrimitives()
+bool Renderer2D::drawRetained(retained_cursor& cursor, uint32_t up_to_sort_layer, int32_t* bound)
+{
+    // Static layer goes first, when it has the same layer as the sprites.
+    bool drawn = false;
+    while (true)
+    {
+        bool has_static = cursor.static_i < mStaticLayers.size() && sortLayer(mStaticLayers[cursor.static_i].layer) <= up_to_sort_layer;
+        bool has_bucket = cursor.bucket_i < mSpriteBuckets.size() && sortLayer(mSpriteBuckets[cursor.bucket_i]->layer) <= up_to_sort_layer;
+        if (has_static && (!has_bucket || sortLayer(mStaticLayers[cursor.static_i].layer) <= sortLayer(mSpriteBuckets[cursor.bucket_i]->layer)))
+        {
+            const static_layer& layer = mStaticLayers[cursor.static_i++];
+            if (!layer.built)
+                continue;
+            drawStaticLayer(layer, bound);
+        }
+        else if (has_bucket)
+            drawSpriteBucket(*mSpriteBuckets[cursor.bucket_i++], bound);
+        else
+            return drawn;
+        drawn = true;
+    }
+}
+void Renderer2D::drawStaticLayer(const static_layer& layer, int32_t* bound)
 {
-    const static Renderer2D::Vertex quad_vertices[4] = {
-        { {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f} },
-        { {0.0f, 1.0f, 0.0f}, {0.0f, 1.0f} },
-        { {1.0f, 0.0f, 0.0f}, {1.0f, 0.0f} },
-        { {1.0f, 1.0f, 0.0f}, {1.0f, 1.0f} },	
+    const Shader& shader = mTextureMode == TextureMode::TextureArray ? mArrayShader : mShader;
+    shader.Use().SetMat4("PV", mPV);
+    uint32_t base_vertex = 0;
+    layer.vao->Bind();
+    for (auto&& group : layer.groups)
+    {
+        uint32_t group_quads = group.mPrimitives_end - group.mPrimitives_start + 1;
+        const uint32_t* p_batches = layer.batches.data() + group.batches_start;
+        if (mpQueue)
+            queueDraw(layer.layer, { &shader, layer.vao, false, base_vertex, group_quads, 0, group.batches_count }, p_batches);
+        else
+        {
+            bindGroupTextures(p_batches, group.batches_count, bound);
+            RenderAPI::DrawElementsBaseVertex(layer.vao, group_quads * 6, 0, base_vertex);
+        }
+        base_vertex += group_quads * 4;
+    }
+    layer.vao->Unbind();
+    mStaticDrawCalls += layer.groups.size();
+    mStaticQuadCount += layer.quad_count;
+}
+void Renderer2D::drawSpriteBucket(const sprite_bucket& bucket, int32_t* bound)
+{
+    // Texture group g uses batches [g * limit, (g + 1) * limit), bound to the units in the same order.
+    const uint32_t limit = getGroupTextureLimit();
+    uint32_t batches[SHADER_TEXTURE_SLOTS];
+    uint32_t batch_count = 0;
+    for (uint32_t batch_i = bucket.texture_group * limit; batch_i < std::min<uint32_t>((bucket.texture_group + 1) * limit, mTextures.size()); batch_i++)
+        batches[batch_count++] = batch_i;
+
+    const Shader& shader = mTextureMode == TextureMode::TextureArray ? mInstancedArrayShader : mInstancedShader;
+    mSpriteDrawCount++;
+    if (mpQueue)
+    {
+        queueDraw(bucket.layer, { &shader, bucket.vao, true, 0, uint32_t(bucket.instances.size()), 0, batch_count }, batches);
+        return;
+    }
+    shader.Use().SetMat4("PV", mPV);
+    bindGroupTextures(batches, batch_count, bound);
+    bucket.vao->Bind();
+    RenderAPI::DrawElementsInstanced(bucket.vao, 6, bucket.instances.size());
+    bucket.vao->Unbind();
+}
+void Renderer2D::queueDraw(Layer layer, queued_draw draw, const uint32_t* p_batches)
+{
+    draw.batches_start = mQueuedBatches.size();
+    mQueuedBatches.insert(mQueuedBatches.end(), p_batches, p_batches + draw.batches_count);
+    uint32_t draw_i = mQueuedDraws.size();
+    mQueuedDraws.push_back(std::move(draw));
+    mpQueue->SubmitCallback(RenderQueue::MakeKey(mQueuePass, layer), [this, draw_i] { drawQueued(mQueuedDraws[draw_i]); });
+}
+void Renderer2D::drawQueued(const queued_draw& draw)
+{
+    // Commands of the other renderers can leave anything bound, so the whole state of the draw is set.
+    draw.p_shader->Use().SetMat4("PV", mPV);
+    int32_t bound[SHADER_TEXTURE_SLOTS];
+    std::fill_n(bound, SHADER_TEXTURE_SLOTS, -1);
+    bindGroupTextures(mQueuedBatches.data() + draw.batches_start, draw.batches_count, bound);
+    draw.vao->Bind();
+    if (draw.instanced)
+    {
+        draw.vao->SetVertexBufferOffset(1, draw.first);
+        RenderAPI::DrawElementsInstanced(draw.vao, 6, draw.quad_count);
+    }
+    else
+        RenderAPI::DrawElementsBaseVertex(draw.vao, draw.quad_count * 6, 0, draw.first);
+    draw.vao->Unbind();
+}
+size_t Renderer2D::findStaticLayer(Layer layer) const
+{
+    auto it = std::lower_bound(mStaticLayers.begin(), mStaticLayers.end(), layer, [](const static_layer& l, Layer layer) { return l.layer < layer; });
+    return it != mStaticLayers.end() && it->layer == layer ? size_t(it - mStaticLayers.begin()) : mStaticLayers.size();
+}
+void Renderer2D::SetLayerStatic(Layer layer, bool is_static)
+{
+    size_t static_i = findStaticLayer(layer);
+    bool found = static_i != mStaticLayers.size();
+    if (is_static && !found)
+    {
+        auto it = std::lower_bound(mStaticLayers.begin(), mStaticLayers.end(), layer, [](const static_layer& l, Layer layer) { return l.layer < layer; });
+        mStaticLayers.insert(it, static_layer{ layer });
+    }
+    else if (!is_static && found)
+        mStaticLayers.erase(mStaticLayers.begin() + static_i);
+}
+bool Renderer2D::IsLayerStatic(Layer layer) const
+{
+    return findStaticLayer(layer) != mStaticLayers.size();
+}
+bool Renderer2D::IsStaticLayerBuilt(Layer layer) const
+{
+    size_t static_i = findStaticLayer(layer);
+    return static_i != mStaticLayers.size() && mStaticLayers[static_i].built;
+}
+void Renderer2D::InvalidateStaticLayer(Layer layer)
+{
+    size_t static_i = findStaticLayer(layer);
+    if (static_i != mStaticLayers.size())
+        mStaticLayers[static_i] = static_layer{ layer };
+}
+void Renderer2D::InvalidateStaticLayers()
+{
+    for (auto&& layer : mStaticLayers)
+        layer = static_layer{ layer.layer };
+}
+SpriteID Renderer2D::CreateSprite(const Transform& trans, const Material& mat, Layer layer)
+{
+    SpriteID id;
+    if (mFreeSprites.size())
+    {
+        id = mFreeSprites.back();
+        mFreeSprites.pop_back();
+    }
+    else
+    {
+        id = SpriteID(mSprites.size());
+        mSprites.emplace_back();
+    }
+    mSprites[id] = { trans, mat, layer };
+    insertSprite(id);
+    mSpriteCount++;
+    return id;
+}
+void Renderer2D::UpdateSprite(SpriteID id, const Transform& trans, const Material& mat)
+{
+    REN_ASSERT(id >= 0 && id < SpriteID(mSprites.size()) && mSprites[id].p_bucket, "Invalid sprite ID (id = " + std::to_string(id) + ").");
+    sprite& spr = mSprites[id];
+    bool same_batch = getTextureUV(spr.material.texture_id).batch_i == getTextureUV(mat.texture_id).batch_i;
+    spr.transform = trans;
+    spr.material = mat;
+    if (!same_batch)
+    {
+        // Texture group can change, so the sprite is moved into another bucket.
+        eraseSprite(id);
+        insertSprite(id);
+        return;
+    }
+    const texture_uv& uv = getTextureUV(mat.texture_id);
+    fillInstance(spr.p_bucket->instances[spr.slot], trans, mat, uv.uv_rect, spriteTexIndex(uv));
+    markSpriteSlot(*spr.p_bucket, spr.slot);
+}
+void Renderer2D::DestroySprite(SpriteID id)
+{
+    REN_ASSERT(id >= 0 && id < SpriteID(mSprites.size()) && mSprites[id].p_bucket, "Invalid sprite ID (id = " + std::to_string(id) + ").");
+    eraseSprite(id);
+    mFreeSprites.push_back(id);
+    mSpriteCount--;
+}
+void Renderer2D::insertSprite(SpriteID id)
+{
+    sprite& spr = mSprites[id];
+    const texture_uv& uv = getTextureUV(spr.material.texture_id);
+    // Untextured sprites can be drawn with any group, so they use the first one.
+    uint32_t texture_group = uv.batch_i < 0 ? 0 : uint32_t(uv.batch_i) / getGroupTextureLimit();
+
+    auto less = [](const std::unique_ptr<sprite_bucket>& p_bucket, std::pair<Layer, uint32_t> key) {
+        return std::make_pair(p_bucket->layer, p_bucket->texture_group) < key;
     };
-    // Create primitives from rendering submissions.
-    // TODO: optimizations like: frustrum culling, merging vertices etc.
-    for (auto& quad_sub : mQuadSubmissions)
-    {   
-        RenderPrimitive primitive;
-        primitive.layer = quad_sub.layer;
-
-        // Create indices.
-        primitive.indices = {0, 1, 2, 1, 2, 3};
-
-        // Pre-compute normalized texture info;
-        glm::vec2 tex_norm_size, tex_norm_offset;
-        batch_tex_desc mapping_desc;
-        if (quad_sub.material.texture_id >= 0)
+    auto it = std::lower_bound(mSpriteBuckets.begin(), mSpriteBuckets.end(), std::make_pair(spr.layer, texture_group), less);
+    if (it == mSpriteBuckets.end() || (*it)->layer != spr.layer || (*it)->texture_group != texture_group)
+    {
+        // Same layout as the instanced path, with its own instance buffer.
+        auto& instance_vbo = mInstanceVAO->GetVertexBuffers()[1];
+        auto vbo = VertexBuffer::Create(NULL, SPRITE_BUCKET_SLOTS * sizeof(QuadInstance), BufferUsage::DynamicDraw);
+        vbo->SetLayout(instance_vbo->GetLayout());
+        vbo->SetDivisor(1);
+        std::unique_ptr<sprite_bucket> p_bucket(new sprite_bucket{ spr.layer, texture_group });
+        p_bucket->vao = VertexArray::Create();
+        p_bucket->vao->AddVertexBuffer(mInstanceVAO->GetVertexBuffers()[0]).AddVertexBuffer(vbo).SetElementBuffer(mInstanceVAO->GetElementBuffer());
+        it = mSpriteBuckets.insert(it, std::move(p_bucket));
+    }
+
+    sprite_bucket& bucket = **it;
+    spr.p_bucket = &bucket;
+    spr.slot = bucket.instances.size();
+    bucket.instances.emplace_back();
+    fillInstance(bucket.instances.back(), spr.transform, spr.material, uv.uv_rect, spriteTexIndex(uv));
+    bucket.owners.push_back(id);
+    bucket.dirty_flags.push_back(0);
+    markSpriteSlot(bucket, spr.slot);
+    if (bucket.instances.size() * sizeof(QuadInstance) > bucket.vao->GetVertexBuffers()[1]->GetSize())
+        bucket.grown = true;
+}
+void Renderer2D::eraseSprite(SpriteID id)
+{
+    sprite& spr = mSprites[id];
+    sprite_bucket& bucket = *spr.p_bucket;
+    uint32_t last = bucket.instances.size() - 1;
+    if (spr.slot != last)
+    {
+        bucket.instances[spr.slot] = bucket.instances[last];
+        bucket.owners[spr.slot] = bucket.owners[last];
+        mSprites[bucket.owners[spr.slot]].slot = spr.slot;
+        markSpriteSlot(bucket, spr.slot);
+    }
+    bucket.instances.pop_back();
+    bucket.owners.pop_back();
+    bucket.dirty_flags.pop_back();
+    spr.p_bucket = nullptr;
+
+    if (bucket.instances.empty())
+        mSpriteBuckets.erase(std::find_if(mSpriteBuckets.begin(), mSpriteBuckets.end(), [&bucket](const std::unique_ptr<sprite_bucket>& p) { return p.get() == &bucket; }));
+}
+void Renderer2D::refreshSprites()
+{
+    // Buckets are created again, as the texture groups can differ.
+    mSpriteBuckets.clear();
+    for (SpriteID id = 0; id < SpriteID(mSprites.size()); id++)
+        if (mSprites[id].p_bucket)
+            insertSprite(id);
+}
+void Renderer2D::uploadSprites()
+{
+    mSpriteUploadRanges = 0;
+    for (auto&& p_bucket : mSpriteBuckets)
+    {
+        sprite_bucket& bucket = *p_bucket;
+        if (bucket.dirty.empty())
+            continue;
+        auto& vbo = bucket.vao->GetVertexBuffers()[1];
+        if (bucket.grown)
         {
-            mapping_desc = mTextureMapping.at(quad_sub.material.texture_id);
-            auto desc = mTextures.at(mapping_desc.batch_i)->GetTextureDescriptor(mapping_desc.desc_i);
-            glm::vec2 batch_tex_size = glm::vec2(desc.pTexture->Width, desc.pTexture->Height);
-            tex_norm_offset = glm::vec2(desc.offset) / batch_tex_size;
-            tex_norm_size = glm::vec2(desc.size) / batch_tex_size;
+            size_t capacity = vbo->GetSize();
+            while (bucket.instances.size() * sizeof(QuadInstance) > capacity)
+                capacity *= 2;
+            vbo->Orphan(capacity);
+            vbo->UpdateData(0, bucket.instances.size() * sizeof(QuadInstance), (float*)bucket.instances.data());
+            mSpriteUploadRanges++;
+        }
+        else
+        {
+            // Slots freed after they were marked are skipped.
+            std::sort(bucket.dirty.begin(), bucket.dirty.end());
+            const uint32_t count = bucket.instances.size();
+            for (size_t i = 0; i < bucket.dirty.size() && bucket.dirty[i] < count; )
+            {
+                uint32_t first = bucket.dirty[i], last = first;
+                for (i++; i < bucket.dirty.size() && bucket.dirty[i] < count && bucket.dirty[i] <= last + SPRITE_MERGE_GAP; i++)
+                    last = bucket.dirty[i];
+                vbo->UpdateData(first * sizeof(QuadInstance), (last - first + 1) * sizeof(QuadInstance), (float*)&bucket.instances[first]);
+                mSpriteUploadRanges++;
+            }
+        }
+        for (uint32_t slot : bucket.dirty)
+            if (slot < bucket.dirty_flags.size())
+                bucket.dirty_flags[slot] = 0;
+        bucket.dirty.clear();
+        bucket.grown = false;
+    }
+}
+void Renderer2D::cullSlice(batch_slice& slice)
+{
+    uint32_t* p_visible = mVisibleSubmissions.data() + slice.begin;
+    uint32_t count = 0;
+    if (!mCulling)
+    {
+        for (uint32_t sub_i = slice.begin; sub_i < slice.end; sub_i++)
+            p_visible[count++] = sub_i;
+        slice.count = count;
+        return;
+    }
 
-            primitive.used_batch_i = mapping_desc.batch_i;
+    // Quad is visible, if |center - view center| <= half size + view half size on both axes.
+    // Rotated quads are tested by the circle around them, so that the test doesn't need the sine and cosine.
+    // Lanes are tested without branches, so the compiler can vectorize the test.
+    const glm::vec2 view_center = mVisibleBounds.GetCenter();
+    const glm::vec2 view_half = 0.5f * mVisibleBounds.GetSize();
+    alignas(32) float cx[QUAD_LANES] = {}, cy[QUAD_LANES] = {}, hx[QUAD_LANES] = {}, hy[QUAD_LANES] = {}, rotation[QUAD_LANES] = {};
+    alignas(32) uint32_t visible[QUAD_LANES];
+    for (uint32_t first = slice.begin; first < slice.end; first += QUAD_LANES)
+    {
+        const uint32_t lane_count = std::min(QUAD_LANES, slice.end - first);
+        for (uint32_t q = 0; q < lane_count; q++)
+        {
+            const Transform& trans = mQuadSubmissions[first + q].transform;
+            hx[q] = 0.5f * std::abs(trans.scale.x);
+            hy[q] = 0.5f * std::abs(trans.scale.y);
+            cx[q] = trans.position.x + 0.5f * trans.scale.x;
+            cy[q] = trans.position.y + 0.5f * trans.scale.y;
+            rotation[q] = trans.rotation;
         }
+        for (uint32_t q = 0; q < QUAD_LANES; q++)
+        {
+            float radius = std::sqrt(hx[q] * hx[q] + hy[q] * hy[q]);
+            float ex = rotation[q] == 0.0f ? hx[q] : radius;
+            float ey = rotation[q] == 0.0f ? hy[q] : radius;
+            visible[q] = uint32_t(std::abs(cx[q] - view_center.x) <= ex + view_half.x) & uint32_t(std::abs(cy[q] - view_center.y) <= ey + view_half.y);
+        }
+        // Index is always written, but only the visible ones are kept.
+        for (uint32_t q = 0; q < lane_count; q++)
+        {
+            p_visible[count] = first + q;
+            count += visible[q];
+        }
+    }
+    slice.count = count;
+}
+void Renderer2D::batchSlice(const batch_slice& slice)
+{
+    // Primitive of k-th visible submission of the slice is at offset + k.
+    const uint32_t* p_visible = mVisibleSubmissions.data() + slice.begin;
+    if (mRenderPath == RenderPath::Instanced)
+    {
+        // Instances are transformed by the vertex shader.
+        for (uint32_t k = 0; k < slice.count; k++)
+        {
+            const QuadSubmission& quad_sub = mQuadSubmissions[p_visible[k]];
+            const texture_uv& uv = getTextureUV(quad_sub.material.texture_id);
+            mPrimitives[slice.offset + k] = { quad_sub.layer, uv.batch_i, primitiveOrder(quad_sub) };
+
+            fillInstance(mInstances[slice.offset + k], quad_sub.transform, quad_sub.material, uv.uv_rect, float(mTextureMode == TextureMode::TextureArray ? uv.page : uv.batch_i));
+        }
+        return;
+    }
 
-        // Create vertices
-        glm::mat4 model = quad_sub.transform.getModelMatrix();
-        for (int i = 0; i < 4; i++)
+    const static glm::vec2 quad_corners[4] = { {0.0f, 0.0f}, {0.0f, 1.0f}, {1.0f, 0.0f}, {1.0f, 1.0f} };
+    const bool use_pages = mTextureMode == TextureMode::TextureArray;
+    quad_lanes lanes;
+    corner_lanes corners;
+    for (uint32_t first = 0; first < slice.count; first += QUAD_LANES)
+    {
+        // Gather the group into structure of arrays. Unused lanes of the last group are left as they were, their results are ignored.
+        const uint32_t lane_count = std::min(QUAD_LANES, slice.count - first);
+        for (uint32_t q = 0; q < lane_count; q++)
         {
-            Vertex v;
-            v.position = glm::vec3(model * glm::vec4(quad_vertices[i].position, 1.0));
-            v.color = quad_sub.material.color;
-            
-            if (quad_sub.material.texture_id >= 0)
+            const Transform& trans = mQuadSubmissions[p_visible[first + q]].transform;
+            lanes.hx[q] = 0.5f * trans.scale.x;
+            lanes.hy[q] = 0.5f * trans.scale.y;
+            lanes.cx[q] = trans.position.x + lanes.hx[q];
+            lanes.cy[q] = trans.position.y + lanes.hy[q];
+            if (trans.rotation == 0.0f)
             {
-                v.tex_coords = quad_vertices[i].tex_coords * tex_norm_size + tex_norm_offset;
-                v.tex_index = mapping_desc.batch_i;
+                lanes.sin[q] = 0.0f;
+                lanes.cos[q] = 1.0f;
             }
             else
             {
-                v.tex_coords = quad_vertices[i].tex_coords;
-                v.tex_index = -1.0f;
+                float angle = glm::radians(-trans.rotation);
+                lanes.sin[q] = std::sin(angle);
+                lanes.cos[q] = std::cos(angle);
             }
+        }
+        computeCorners(lanes, corners);
+
+        for (uint32_t q = 0; q < lane_count; q++)
+        {
+            const uint32_t out_i = slice.offset + first + q;
+            const QuadSubmission& quad_sub = mQuadSubmissions[p_visible[first + q]];
+            const texture_uv& uv = getTextureUV(quad_sub.material.texture_id);
+            mPrimitives[out_i] = { quad_sub.layer, uv.batch_i, primitiveOrder(quad_sub) };
 
-            primitive.vertices.push_back(v);
+            Vertex* p_vertices = &mVertices[out_i * 4];
+            for (int i = 0; i < 4; i++)
+            {
+                Vertex& v = p_vertices[i];
+                v.position = glm::vec3(corners.x[i][q], corners.y[i][q], 0.0f);
+                v.tex_coords = glm::vec2(uv.uv_rect) + quad_corners[i] * glm::vec2(uv.uv_rect.z, uv.uv_rect.w);
+                v.tex_index = float(use_pages ? uv.page : uv.batch_i);
+                v.color = quad_sub.material.color;
+            }
         }
+    }
+}
+void Renderer2D::fillInstance(QuadInstance& instance, const Transform& trans, const Material& mat, const glm::vec4& uv_rect, float tex_index) const
+{
+    glm::u8vec4 color = glm::u8vec4(glm::round(glm::clamp(mat.color, 0.0f, 1.0f) * 255.0f));
+    instance.position = trans.position;
+    instance.scale = trans.scale;
+    instance.rotation = trans.rotation;
+    instance.uv_rect = uv_rect;
+    instance.tex_index = tex_index;
+    instance.color = uint32_t(color.r) | uint32_t(color.g) << 8 | uint32_t(color.b) << 16 | uint32_t(color.a) << 24;
+}
+void Renderer2D::buildSlices(uint32_t count)
+{
+    mSlices.clear();
+    uint32_t thread_count = mpThreadPool ? mpThreadPool->GetThreadCount() : 1;
+    // Few slices per thread, so that the work is balanced even if some threads start late.
+    uint32_t slice_size = std::max(MIN_SLICE_QUADS, count / (thread_count * 2));
+    slice_size = (slice_size + QUAD_LANES - 1) / QUAD_LANES * QUAD_LANES;
 
-        mPrimitives.push_back(primitive);
+    uint32_t offset = 0;
+    for (uint32_t begin = 0; begin < count; begin += slice_size)
+    {
+        batch_slice slice = { begin, std::min(count, begin + slice_size), offset, 0 };
+        slice.count = slice.end - slice.begin;
+        offset += slice.count;
+        mSlices.push_back(slice);
     }
-    mQuadSubmissions.clear();
+}
+template<typename TFunc>
+void Renderer2D::runSlices(TFunc&& func)
+{
+    if (mSlices.size() <= 1 || !mpThreadPool || mpThreadPool->GetWorkerCount() == 0)
+    {
+        for (auto&& slice : mSlices)
+            func(slice);
+        return;
+    }
+
+    // Slices are taken by the counter, so there is only one task per helping worker. Task captures two references,
+    // which fit into the local storage of std::function (16 bytes in libstdc++), so the dispatch doesn't allocate.
+    std::atomic<uint32_t> next{ 0 };
+    auto take_slices = [this, &func, &next] {
+        for (uint32_t slice_i = next++; slice_i < mSlices.size(); slice_i = next++)
+            func(mSlices[slice_i]);
+    };
+    const uint32_t helpers = std::min<uint32_t>(mpThreadPool->GetWorkerCount(), mSlices.size() - 1);
+    std::atomic<uint32_t> running{ helpers };
+    for (uint32_t i = 0; i < helpers; i++)
+        mpThreadPool->Submit([&take_slices, &running] {
+            take_slices();
+            running--;
+        });
+    take_slices();
+    // Helpers reference this frame, so all of them have to finish, even those which found no slice left.
+    mpThreadPool->WaitUntil([&running] { return running == 0; });
+}
+void Renderer2D::updateTextureUVs()
+{
+    mTextureUVs.assign(mTextureMapping.size(), texture_uv());
+    for (auto&& mapping : mTextureMapping)
+    {
+        // Deleted textures are rendered as untextured.
+        if (mapping.texture_id == TEXTURE_NONE)
+            continue;
+        const TextureDescriptor& desc = mTextures[mapping.batch_i]->GetTextureDescriptor(mapping.desc_i);
+        glm::vec2 batch_tex_size = glm::vec2(desc.pTexture->Width, desc.pTexture->Height);
+        mTextureUVs[mapping.texture_id] = { glm::vec4(glm::vec2(desc.offset) / batch_tex_size, glm::vec2(desc.size) / batch_tex_size), int32_t(mapping.batch_i), desc.page };
+    }
+    refreshSprites();
 }
 void Renderer2D::groupByLayers()
 {
-    std::stable_sort(mPrimitives.begin(), mPrimitives.end(), [](const RenderPrimitive& a, const RenderPrimitive& b){
-        return a.layer < b.layer;
+    // Sort only the keys, primitives stay where they are.
+    buildSlices(mPrimitives.size());
+    mSortKeys.resize(mPrimitives.size());
+    const bool by_batch = mSortMode == SortMode::TextureBatch;
+    runSlices([this, by_batch](const batch_slice& slice) {
+        for (uint32_t i = slice.begin; i < slice.end; i++)
+        {
+            const RenderPrimitive& primitive = mPrimitives[i];
+            uint64_t layer = sortLayer(primitive.layer);
+            uint64_t batch = by_batch ? uint16_t(primitive.used_batch_i + 1) : 0;
+            mSortKeys[i] = { layer << 48 | batch << 32 | primitive.order, i };
+        }
     });
+    sortKeys();
 
-    mRenderGroups.push_back(render_group{0, uint32_t(mPrimitives.size() - 1)});
+    // Built static layers and sprites are drawn between the groups, so no group can contain layers from both sides of them.
+    mLayerSplits.clear();
+    for (auto&& layer : mStaticLayers)
+        if (layer.built)
+            mLayerSplits.push_back(sortLayer(layer.layer));
+    for (auto&& p_bucket : mSpriteBuckets)
+        mLayerSplits.push_back(sortLayer(p_bucket->layer));
+    std::sort(mLayerSplits.begin(), mLayerSplits.end());
+
+    mRenderGroups.clear();
+    uint32_t start = 0;
+    for (uint32_t split_layer : mLayerSplits)
+    {
+        uint64_t layer_key = uint64_t(split_layer) << 48;
+        uint32_t split = std::lower_bound(mSortKeys.begin() + start, mSortKeys.end(), layer_key, [](const sort_key& k, uint64_t key) { return k.key < key; }) - mSortKeys.begin();
+        if (split > start && split < mSortKeys.size())
+        {
+            mRenderGroups.push_back(render_group{ start, split - 1 });
+            start = split;
+        }
+    }
+    mRenderGroups.push_back(render_group{ start, uint32_t(mPrimitives.size() - 1) });
 }
-void Renderer2D::groupByMaxTextures()
+void Renderer2D::sortKeys()
 {
+    const uint32_t count = mSortKeys.size();
+    mSortScratch.resize(count);
+
+    // Find out, which parts of the keys differ.
+    uint64_t key_or = 0, key_and = ~uint64_t(0);
+    uint32_t min_layer = UINT16_MAX, max_layer = 0;
+    for (auto&& k : mSortKeys)
+    {
+        key_or |= k.key;
+        key_and &= k.key;
+        uint32_t layer = uint32_t(k.key >> 48);
+        min_layer = std::min(min_layer, layer);
+        max_layer = std::max(max_layer, layer);
+    }
+    const uint64_t varying = key_or ^ key_and;
+    if (varying == 0)
+        return;
 
+    if ((varying & 0x0000FFFFFFFFFFFF) == 0 && max_layer - min_layer < COUNTING_SORT_MAX_LAYERS)
+    {
+        // Only the layer differs and there are few layers, so single counting sort pass is enough.
+        uint32_t offsets[COUNTING_SORT_MAX_LAYERS] = {};
+        for (auto&& k : mSortKeys)
+            offsets[uint32_t(k.key >> 48) - min_layer]++;
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i <= max_layer - min_layer; i++)
+            sum += std::exchange(offsets[i], sum);
+        for (auto&& k : mSortKeys)
+            mSortScratch[offsets[uint32_t(k.key >> 48) - min_layer]++] = k;
+        mSortKeys.swap(mSortScratch);
+        return;
+    }
+
+    // LSD radix sort by bytes. Bytes, which are equal in all keys, are skipped.
+    uint32_t histograms[8][256] = {};
+    for (auto&& k : mSortKeys)
+        for (uint32_t b = 0; b < 8; b++)
+            histograms[b][(k.key >> (b * 8)) & 0xFF]++;
+    for (uint32_t b = 0; b < 8; b++)
+    {
+        if (((varying >> (b * 8)) & 0xFF) == 0)
+            continue;
+        uint32_t* offsets = histograms[b];
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < 256; i++)
+            sum += std::exchange(offsets[i], sum);
+        for (auto&& k : mSortKeys)
+            mSortScratch[offsets[(k.key >> (b * 8)) & 0xFF]++] = k;
+        mSortKeys.swap(mSortScratch);
+    }
 }
-void Renderer2D::groupBySize()
+void Renderer2D::groupByMaxTextures()
 {
-    // If some groups are bigger than Quad VBO, then they are splitted, until they match the size requirements.
-
-    std::vector<std::pair<std::list<render_group>::iterator, uint32_t>> groups_to_split; 
-    for (auto group_it = mRenderGroups.begin(); group_it != mRenderGroups.end(); group_it++)
+    // Group is closed before the primitive, which would exceed the texture units. Primitives stay in the render order,
+    // so this greedy split gives the least draws possible for that order. Only SortMode::TextureBatch orders
+    // the primitives by their batches, so that the splits are rare.
+    mSplitGroups.clear();
+    for (auto&& group : mRenderGroups)
     {
-        uint32_t group_size = 0;
-        for (uint32_t i = group_it->mPrimitives_start; i <= group_it->mPrimitives_end; i++)
+        render_group part = group;
+        uint32_t used[SHADER_TEXTURE_SLOTS];
+        uint32_t used_count = 0;
+        for (uint32_t pos = group.mPrimitives_start; pos <= group.mPrimitives_end; pos++)
         {
-            group_size += mPrimitives[i].vertices.size() * sizeof(Vertex);
-
-            if (group_size >= mVBOSize) {
-                groups_to_split.push_back({ group_it, i });
-                group_size = mPrimitives[i].vertices.size() * sizeof(Vertex);
+            int32_t batch_i = mPrimitives[primitiveAt(pos)].used_batch_i;
+            if (batch_i < 0 || std::find(used, used + used_count, uint32_t(batch_i)) != used + used_count)
+                continue;
+            if (used_count == getGroupTextureLimit())
+            {
+                part.mPrimitives_end = pos - 1;
+                mSplitGroups.push_back(part);
+                part.mPrimitives_start = pos;
+                used_count = 0;
             }
+            used[used_count++] = batch_i;
         }
+        part.mPrimitives_end = group.mPrimitives_end;
+        mSplitGroups.push_back(part);
     }
-
-    for (auto&& i : groups_to_split)
+    mTextureUnitSplits = mSplitGroups.size() - mRenderGroups.size();
+    mRenderGroups.assign(mSplitGroups.begin(), mSplitGroups.end());
+}
+void Renderer2D::groupBySize()
+{
+    // If some groups are bigger than allowed for single draw call, then they are splitted, until they match the size requirements.
+    mSplitGroups.clear();
+    for (auto&& group : mRenderGroups)
     {
-        render_group new_group;
-        new_group.mPrimitives_start = i.first->mPrimitives_start;
-        new_group.mPrimitives_end = i.second - 1;
-        i.first->mPrimitives_start = i.second;
-        mRenderGroups.insert(i.first, new_group);
+        render_group part = group;
+        while (part.mPrimitives_end - part.mPrimitives_start + 1 > mMaxGroupQuads)
+        {
+            // Every primitive is a quad.
+            render_group first = part;
+            first.mPrimitives_end = part.mPrimitives_start + mMaxGroupQuads - 1;
+            mSplitGroups.push_back(first);
+            part.mPrimitives_start += mMaxGroupQuads;
+        }
+        mSplitGroups.push_back(part);
     }
+    // Copy instead of swapping, so both containers keep their memory.
+    mRenderGroups.assign(mSplitGroups.begin(), mSplitGroups.end());
 }
-void Renderer2D::offsetIndices()
+void Renderer2D::collectGroupBatches()
 {
+    mGroupBatches.clear();
+    mTextureSlots.resize(mSortKeys.size());
     for (auto&& group : mRenderGroups)
     {
-        uint32_t offset = 0;
-        for (auto i = mPrimitives.begin() + group.mPrimitives_start; i != mPrimitives.begin() + group.mPrimitives_end + 1; i++)
+        group.batches_start = mGroupBatches.size();
+        for (uint32_t pos = group.mPrimitives_start; pos <= group.mPrimitives_end; pos++)
         {
             // Update group used texture batches, if given batch isn't already registered.
-            if (i->used_batch_i >= 0 && std::find(group.used_batches.begin(), group.used_batches.end(), i->used_batch_i) == group.used_batches.end())
-                group.used_batches.push_back(i->used_batch_i);
-            
-            // Update primitive indices with the number of vertexes to be rendered before them.
-            for (auto&& j : i->indices)
-                j += offset;
-            offset += i->vertices.size();
-        }   
+            int32_t batch_i = mPrimitives[primitiveAt(pos)].used_batch_i;
+            if (batch_i < 0)
+            {
+                mTextureSlots[pos] = -1;
+                continue;
+            }
+            auto it = std::find(mGroupBatches.begin() + group.batches_start, mGroupBatches.end(), uint32_t(batch_i));
+            if (it == mGroupBatches.end())
+                it = mGroupBatches.insert(it, batch_i);
+            mTextureSlots[pos] = int32_t(it - (mGroupBatches.begin() + group.batches_start));
+        }
+        group.batches_count = mGroupBatches.size() - group.batches_start;
     }
 }
 void Renderer2D::renderGroups()
 {
     // Update global uniforms
-    mShader.Use().SetMat4("PV", mPV);
+    Shader& shader = mTextureMode == TextureMode::TextureArray ? mArrayShader : mShader;
+    shader.Use().SetMat4("PV", mPV);
+
+    // Geometry of the whole frame is written at once, so the buffer is mapped only once per frame.
+    uint32_t vertex_count = mPrimitives.size() * 4;
+    auto& vbo = mQuadVAO->GetVertexBuffers()[0];
+    uint32_t vbo_offset = reserveStream(*vbo, mVBOHead, vertex_count * sizeof(Vertex), sizeof(Vertex));
 
+    // Nothing written since the last orphaning is overwritten, so there is no need to synchronize with the GPU.
+    // Vertices are gathered in the render order.
+    // Workers gather slices of the render order, the buffer is mapped and unmapped on this thread.
+    Vertex* p_vertices = static_cast<Vertex*>(vbo->Map(vbo_offset, vertex_count * sizeof(Vertex), true));
+    buildSlices(mSortKeys.size());
+    // With atlases, texture index of the vertices is replaced by the texture unit, to which their batch is bound in the group.
+    // Texture array keeps the page.
+    const bool use_slots = mTextureMode == TextureMode::Atlases;
+    runSlices([this, p_vertices, use_slots](const batch_slice& slice) {
+        for (uint32_t pos = slice.begin; pos < slice.end; pos++)
+        {
+            Vertex* p_dst = std::copy_n(&mVertices[primitiveAt(pos) * 4], 4, p_vertices + pos * 4) - 4;
+            if (use_slots)
+                for (int i = 0; i < 4; i++)
+                    p_dst[i].tex_index = float(mTextureSlots[pos]);
+        }
+    });
+    vbo->Unmap();
+
+    // Primitives of the groups follow each other, so the groups are drawn from consecutive ranges of the buffer.
+    // All groups use the beginning of the shared quad index buffer, offset by the base vertex.
+    uint32_t base_vertex = vbo_offset / sizeof(Vertex);
+    mQuadVAO->Bind();
+    int32_t bound[SHADER_TEXTURE_SLOTS];
+    std::fill_n(bound, SHADER_TEXTURE_SLOTS, -1);
+    retained_cursor cursor;
     for (auto&& group : mRenderGroups)
     {
-        auto p_begin = mPrimitives.begin() + group.mPrimitives_start;
-        auto p_end = mPrimitives.begin() + group.mPrimitives_end + 1;
+        uint32_t group_quads = group.mPrimitives_end - group.mPrimitives_start + 1;
 
-        // Upload vertices to GPU
-        uint32_t total_size = 0, size = 0;
-        for (auto p = p_begin; p != p_end; p++)
+        // TODO: Update uniforms
+
+        // Static layers and sprites below the group.
+        if (drawRetained(cursor, uint32_t(mSortKeys[group.mPrimitives_start].key >> 48), bound))
         {
-            size = p->vertices.size() * sizeof(Vertex);
-            std::memcpy((uint8_t*)mpBuffer + total_size, p->vertices.data(), size);
-            total_size += size;
+            shader.Use();
+            mQuadVAO->Bind();
         }
-        mQuadVAO->GetVertexBuffers()[0]->UpdateData(0, total_size, (float*)mpBuffer);
-
-        // Upload indices to GPU
-        total_size = size = 0;
-        for (auto p = p_begin; p != p_end; p++)
+        const uint32_t* p_batches = mGroupBatches.data() + group.batches_start;
+        if (mpQueue)
+            queueDraw(mPrimitives[primitiveAt(group.mPrimitives_start)].layer, { &shader, mQuadVAO, false, base_vertex, group_quads, 0, group.batches_count }, p_batches);
+        else
         {
-            size = p->indices.size() * sizeof(uint32_t);
-            std::memcpy((uint8_t*)mpBuffer + total_size, p->indices.data(), size);
-            total_size += size;
+            bindGroupTextures(p_batches, group.batches_count, bound);
+
+            // Render
+            RenderAPI::DrawElementsBaseVertex(mQuadVAO, group_quads * 6, 0, base_vertex);
         }
-        mQuadVAO->GetElementBuffer()->UpdateData(0, total_size, (uint32_t*)mpBuffer);
+        base_vertex += group_quads * 4;
+    }
+    mQuadVAO->Unbind();
+    drawRetained(cursor, UINT32_MAX, bound);
+}
+void Renderer2D::renderGroupsInstanced()
+{
+    Shader& shader = mTextureMode == TextureMode::TextureArray ? mInstancedArrayShader : mInstancedShader;
+    shader.Use().SetMat4("PV", mPV);
 
-        // TODO: Update uniforms
+    uint32_t instance_count = mPrimitives.size();
+    auto& vbo = mInstanceVAO->GetVertexBuffers()[1];
+    uint32_t vbo_offset = reserveStream(*vbo, mInstanceHead, instance_count * sizeof(QuadInstance), sizeof(QuadInstance));
 
-        // Bind textures to corresponding units.
-        for (auto i : group.used_batches) {
-            RenderAPI::SetActiveTextureUnit(i);
-            mTextures[i]->Bind();
+    QuadInstance* p_instances = static_cast<QuadInstance*>(vbo->Map(vbo_offset, instance_count * sizeof(QuadInstance), true));
+    buildSlices(mSortKeys.size());
+    const bool use_slots = mTextureMode == TextureMode::Atlases;
+    runSlices([this, p_instances, use_slots](const batch_slice& slice) {
+        for (uint32_t pos = slice.begin; pos < slice.end; pos++)
+        {
+            p_instances[pos] = mInstances[primitiveAt(pos)];
+            if (use_slots)
+                p_instances[pos].tex_index = float(mTextureSlots[pos]);
         }
+    });
+    vbo->Unmap();
+
+    // GL 3.3 has no base instance, so the instance attributes are pointed to the first instance of every group instead.
+    uint32_t first_instance = 0;
+    mInstanceVAO->Bind();
+    int32_t bound[SHADER_TEXTURE_SLOTS];
+    std::fill_n(bound, SHADER_TEXTURE_SLOTS, -1);
+    retained_cursor cursor;
+    for (auto&& group : mRenderGroups)
+    {
+        uint32_t group_quads = group.mPrimitives_end - group.mPrimitives_start + 1;
 
-        // Render
-        mQuadVAO->Bind();
-        RenderAPI::DrawElements(mQuadVAO, total_size / sizeof(uint32_t));
-        mQuadVAO->Unbind();
+        if (drawRetained(cursor, uint32_t(mSortKeys[group.mPrimitives_start].key >> 48), bound))
+        {
+            shader.Use();
+            mInstanceVAO->Bind();
+        }
+        const uint32_t* p_batches = mGroupBatches.data() + group.batches_start;
+        uint32_t instance_offset = vbo_offset + first_instance * sizeof(QuadInstance);
+        if (mpQueue)
+            queueDraw(mPrimitives[primitiveAt(group.mPrimitives_start)].layer, { &shader, mInstanceVAO, true, instance_offset, group_quads, 0, group.batches_count }, p_batches);
+        else
+        {
+            bindGroupTextures(p_batches, group.batches_count, bound);
+            mInstanceVAO->SetVertexBufferOffset(1, instance_offset);
+            RenderAPI::DrawElementsInstanced(mInstanceVAO, 6, group_quads);
+        }
+        first_instance += group_quads;
+    }
+    mInstanceVAO->Unbind();
+    drawRetained(cursor, UINT32_MAX, bound);
+}
+void Renderer2D::bindGroupTextures(const uint32_t* p_batches, uint32_t batch_count, int32_t* bound)
+{
+    for (uint32_t i = 0; i < batch_count; i++)
+    {
+        int32_t batch_i = int32_t(p_batches[i]);
+        if (bound[i] == batch_i)
+            continue;
+        RenderAPI::SetActiveTextureUnit(i);
+        mTextures[batch_i]->Bind();
+        bound[i] = batch_i;
+    }
+}
+template<typename TBuffer>
+uint32_t Renderer2D::reserveStream(TBuffer& buffer, uint32_t& head, uint32_t size, uint32_t alignment)
+{
+    uint32_t offset = (head + alignment - 1) / alignment * alignment;
+    if (size * STREAM_FRAMES > buffer.GetSize())
+    {
+        // Grow, so that the buffer can hold a few frames and orphaning stays rare.
+        size_t capacity = buffer.GetSize();
+        while (size * STREAM_FRAMES > capacity)
+            capacity *= 2;
+        buffer.Orphan(capacity);
+        offset = 0;
+    }
+    else if (offset + size > buffer.GetSize())
+    {
+        buffer.Orphan(buffer.GetSize());
+        offset = 0;
     }
+    head = offset + size;
+    return offset;
 }
 void Renderer2D::BeginPrepare()
 {
@@ -262,8 +1184,14 @@ int32_t Renderer2D::PrepareTexture(const RawTexture& texture)
 {
     REN_ASSERT(mPreparing, "Not in preparing state. You must first call BeginPrepare().");
 
+    // Texture array stores all pages in single batch. New batch is created only when it runs out of layers.
+    auto create_batch = [this]() {
+        auto batch = TextureBatch::Create();
+        batch->UseTextureArray = mTextureMode == TextureMode::TextureArray;
+        return batch;
+    };
     if (mTextures.size() == 0)
-        mTextures.push_back(TextureBatch::Create());
+        mTextures.push_back(create_batch());
 
     auto batch = mTextures.back();
     int32_t desc_i = batch->AddTexture(texture);
@@ -273,7 +1201,7 @@ int32_t Renderer2D::PrepareTexture(const RawTexture& texture)
     // Most probably, there is no more space for the texture in the first batch.
     if (desc_i < 0)
     {
-        auto batch_new = TextureBatch::Create();
+        auto batch_new = create_batch();
         desc_i = batch_new->AddTexture(texture);
 
         REN_ASSERT(desc_i >= 0, "Failed batching texture.");
@@ -303,6 +1231,11 @@ void Renderer2D::RemoveTexture(TextureID id)
     tex_desc.batch_i = uint32_t(-1);
     tex_desc.desc_i = uint32_t(-1);
     tex_desc.texture_id = TEXTURE_NONE;
+    if (!mPreparing)
+    {
+        updateTextureUVs();
+        InvalidateStaticLayers();
+    }
 }
 void Renderer2D::EndPrepare()
 {
@@ -312,13 +1245,18 @@ void Renderer2D::EndPrepare()
         batch->Build();
         REN_ASSERT(batch->ID != 0, "Batch texture was not created.");
     }
+    updateTextureUVs();
+    // Static geometry refers to the old batches.
+    InvalidateStaticLayers();
 
     mPreparing = false;
 }
 void Renderer2D::ClearResources()
 {
     mTextureMapping.clear();
+    mTextureUVs.clear();
     mTextures.clear();
+    InvalidateStaticLayers();
 }
 TextureDescriptor Renderer2D::GetTextureDescriptor(TextureID texture_id)
 {
@@ -3,6 +3,28 @@
 
 using namespace Ren::Legacy;
 
+namespace
+{
+	// Uniforms of a queued sprite.
+	struct sr_Uniforms
+	{
+		glm::mat4 model;
+		glm::vec3 color;
+		glm::vec4 scale_offset;
+		glm::ivec2 inverse_tex;
+		int force_color;
+
+		void Apply(const Ren::Shader& shader) const
+		{
+			shader.SetMat4("model", model);
+			shader.SetVec3f("spriteColor", color);
+			shader.SetVec4f("spriteScaleOffset", scale_offset);
+			shader.SetVec2i("inverse_tex", inverse_tex);
+			shader.SetInt("force_color", force_color);
+		}
+	};
+}
+
 SpriteRenderer::SpriteRenderer(Shader shader)
 {
 	this->shader = shader;
@@ -13,35 +35,55 @@ SpriteRenderer::~SpriteRenderer()
 	glDeleteVertexArrays(1, &this->quadVAO);
 }
 
-SpriteRenderer& SpriteRenderer::RenderSprite(const Texture2D& texture, glm::vec2 position, glm::vec2 size, float rotate, glm::vec3 color)
+void SpriteRenderer::SetRenderQueue(RenderQueue* p_queue, uint32_t pass, int32_t layer)
 {
-	this->shader.Use();
-
-	glm::mat4 model = glm::mat4(1.0f);
-	model = glm::translate(model, glm::vec3(position, 0.0));
-	model = glm::translate(model, glm::vec3(0.5f * size.x, 0.5f * size.y, 0.0f));
-	model = glm::rotate(model, glm::radians(rotate), glm::vec3(0.0f, 0.0f, 1.0f));
-	model = glm::translate(model, glm::vec3(-0.5f * size.x, -0.5f * size.y, 0.0f));
-	model = glm::scale(model, glm::vec3(size.x, size.y, 1.0f));
+	this->p_queue = p_queue;
+	queue_pass = pass;
+	queue_layer = layer;
+}
+void SpriteRenderer::draw(unsigned int texture, unsigned int target, const glm::mat4& model, glm::vec3 color, glm::vec4 scale_offset, glm::ivec2 inverse_tex)
+{
+	if (p_queue)
+	{
+		RenderQueue::DrawCommand cmd;
+		cmd.shader = shader.ID;
+		cmd.vao = quadVAO;
+		cmd.mode = GL_TRIANGLE_STRIP;
+		cmd.count = 4;
+		cmd.texture = texture;
+		cmd.texture_target = target;
+		p_queue->Submit(RenderQueue::MakeKey(queue_pass, queue_layer, shader.ID, texture), cmd, sr_Uniforms{ model, color, scale_offset, inverse_tex, int(force_color) });
+		return;
+	}
 
+	this->shader.Use();
 	this->shader.SetMat4("model", model);
 	this->shader.SetVec3f("spriteColor", color);
-	this->shader.SetVec4f("spriteScaleOffset", glm::vec4(1.0f, 1.0f, 0.0f, 0.0f));
-	this->shader.SetVec2i("inverse_tex", int(texture.FlipHorizontally), int(texture.FlipVertically));
+	this->shader.SetVec4f("spriteScaleOffset", scale_offset);
+	this->shader.SetVec2i("inverse_tex", inverse_tex);
+	this->shader.SetInt("force_color", int(force_color));
 
 	glActiveTexture(GL_TEXTURE0);
-	texture.Bind();
+	glBindTexture(target, texture);
 
 	glBindVertexArray(this->quadVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	glBindVertexArray(0);
+}
+SpriteRenderer& SpriteRenderer::RenderSprite(const Texture2D& texture, glm::vec2 position, glm::vec2 size, float rotate, glm::vec3 color)
+{
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(position, 0.0));
+	model = glm::translate(model, glm::vec3(0.5f * size.x, 0.5f * size.y, 0.0f));
+	model = glm::rotate(model, glm::radians(rotate), glm::vec3(0.0f, 0.0f, 1.0f));
+	model = glm::translate(model, glm::vec3(-0.5f * size.x, -0.5f * size.y, 0.0f));
+	model = glm::scale(model, glm::vec3(size.x, size.y, 1.0f));
 
+	draw(texture.ID, texture.BindTarget, model, color, glm::vec4(1.0f, 1.0f, 0.0f, 0.0f), glm::ivec2(int(texture.FlipHorizontally), int(texture.FlipVertically)));
 	return *this;
 }
 SpriteRenderer& SpriteRenderer::RenderPartialSprite(const Texture2D& texture, glm::vec2 vPartOffset, glm::vec2 vPartSize, glm::vec2 vPosition, glm::vec2 vSize, float fRotate, glm::vec3 vColor)
 {
-	this->shader.Use();
-
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::translate(model, glm::vec3(vPosition, 0.0f));
 	model = glm::translate(model, glm::vec3(0.5f * vSize.x, 0.5f * vSize.y, 0.0f));
@@ -49,27 +91,14 @@ SpriteRenderer& SpriteRenderer::RenderPartialSprite(const Texture2D& texture, gl
 	model = glm::translate(model, glm::vec3(-0.5f * vSize.x, -0.5f * vSize.y, 0.0f));
 	model = glm::scale(model, glm::vec3(vSize.x, vSize.y, 1.0f));
 
-	this->shader.SetMat4("model", model);
-	this->shader.SetVec3f("spriteColor", vColor);
-	this->shader.SetVec2i("inverse_tex", int(texture.FlipHorizontally), int(texture.FlipVertically));
-
 	glm::vec2 vSpriteScale = vPartSize / glm::vec2(texture.Width, texture.Height);
 	glm::vec2 vSpriteOffset = vPartOffset / glm::vec2(texture.Width, texture.Height);
-	this->shader.SetVec4f("spriteScaleOffset", glm::vec4(vSpriteScale, vSpriteOffset));
-
-	glActiveTexture(GL_TEXTURE0);
-	texture.Bind();
-
-	glBindVertexArray(this->quadVAO);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
 
+	draw(texture.ID, texture.BindTarget, model, vColor, glm::vec4(vSpriteScale, vSpriteOffset), glm::ivec2(int(texture.FlipHorizontally), int(texture.FlipVertically)));
 	return *this;
 }
 SpriteRenderer& SpriteRenderer::RenderGLTexture(unsigned int ID, glm::vec2 vPosition, glm::vec2 vSize, float fRotate, glm::vec3 vColor, bool bFlipH, bool bFlipV)
 {
-	this->shader.Use();
-
 	glm::mat4 model = glm::mat4(1.0f);
 	model = glm::translate(model, glm::vec3(vPosition, 0.0));
 	model = glm::translate(model, glm::vec3(0.5f * vSize.x, 0.5f * vSize.y, 0.0f));
@@ -77,18 +106,7 @@ SpriteRenderer& SpriteRenderer::RenderGLTexture(unsigned int ID, glm::vec2 vPosi
 	model = glm::translate(model, glm::vec3(-0.5f * vSize.x, -0.5f * vSize.y, 0.0f));
 	model = glm::scale(model, glm::vec3(vSize.x, vSize.y, 1.0f));
 
-	this->shader.SetMat4("model", model);
-	this->shader.SetVec3f("spriteColor", vColor);
-	this->shader.SetVec4f("spriteScaleOffset", glm::vec4(1.0f, 1.0f, 0.0f, 0.0f));
-	this->shader.SetVec2i("inverse_tex", int(bFlipH), int(bFlipV));
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, ID);
-
-	glBindVertexArray(this->quadVAO);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
-
+	draw(ID, GL_TEXTURE_2D, model, vColor, glm::vec4(1.0f, 1.0f, 0.0f, 0.0f), glm::ivec2(int(bFlipH), int(bFlipV)));
 	return *this;
 }
 void SpriteRenderer::initRenderData()
@@ -0,0 +1,422 @@
+#include "Ren/ecs/SceneSerializer.hpp"
+#include "Ren/ecs/Components.hpp"
+#include "engine_config.h"
+#include <fstream>
+#include <algorithm>
+#ifdef PLATFORM_WINDOWS
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+using namespace Ren;
+using namespace Ren::ecs;
+
+// ==================
+// Utils
+// ==================
+namespace
+{
+    const char FILE_MAGIC[4] = { 'R', 'E', 'N', 'S' };
+    // All sections in the file are aligned to this many bytes.
+    const size_t SECTION_ALIGN = 8;
+
+    struct file_header {
+        char magic[4];
+        uint32_t version;
+        uint32_t entity_count;
+        uint32_t free_count;
+        uint32_t column_count;
+        uint32_t reserved;
+    };
+    struct column_header {
+        uint32_t name_length;
+        // Size of single component for raw columns, 0 for tags and custom columns.
+        uint32_t element_size;
+        uint32_t count;
+        uint32_t custom;
+        uint64_t data_size;
+    };
+
+    inline size_t alignSize(size_t size) { return (size + SECTION_ALIGN - 1) / SECTION_ALIGN * SECTION_ALIGN; }
+
+    // Read-only memory mapping of the whole file.
+    class mapped_file
+    {
+    public:
+        const uint8_t* data{ nullptr };
+        size_t size{ 0 };
+
+        mapped_file(const char* filename)
+        {
+#ifdef PLATFORM_WINDOWS
+            mFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (mFile == INVALID_HANDLE_VALUE)
+                return;
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(mFile, &file_size) || file_size.QuadPart == 0)
+                return;
+            mMapping = CreateFileMappingA(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (!mMapping)
+                return;
+            data = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+            size = data ? size_t(file_size.QuadPart) : 0;
+#else
+            int fd = open(filename, O_RDONLY);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && st.st_size > 0)
+            {
+                void* p_map = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p_map != MAP_FAILED)
+                {
+                    data = static_cast<const uint8_t*>(p_map);
+                    size = size_t(st.st_size);
+                }
+            }
+            close(fd);
+#endif
+        }
+        ~mapped_file()
+        {
+#ifdef PLATFORM_WINDOWS
+            if (data)
+                UnmapViewOfFile(data);
+            if (mMapping)
+                CloseHandle(mMapping);
+            if (mFile != INVALID_HANDLE_VALUE)
+                CloseHandle(mFile);
+#else
+            if (data)
+                munmap(const_cast<uint8_t*>(data), size);
+#endif
+        }
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+    private:
+#ifdef PLATFORM_WINDOWS
+        HANDLE mFile{ INVALID_HANDLE_VALUE };
+        HANDLE mMapping{ NULL };
+#endif
+    };
+
+    // Sequential bounds-checked reader of the mapped file.
+    struct file_reader
+    {
+        const uint8_t* data;
+        size_t size;
+        size_t offset{ 0 };
+
+        // Return pointer to next section of given size and move past it (including the alignment). Returns nullptr if out of bounds.
+        const uint8_t* section(size_t section_size)
+        {
+            if (section_size > size - offset)
+                return nullptr;
+            const uint8_t* p_section = data + offset;
+            offset = std::min(size, offset + alignSize(section_size));
+            return p_section;
+        }
+    };
+
+    void writeSection(std::ofstream& file, const void* data, size_t size)
+    {
+        const char padding[SECTION_ALIGN] = {};
+        file.write(static_cast<const char*>(data), size);
+        file.write(padding, alignSize(size) - size);
+    }
+}
+
+
+// ======================
+// Registry
+// ======================
+std::vector<SceneSerializer::component_desc>& SceneSerializer::registry()
+{
+    static std::vector<component_desc> s_registry;
+    static bool s_initialized = false;
+    if (!s_initialized)
+    {
+        s_initialized = true;
+        RegisterComponent<components::Transform2D>("Transform2D");
+        RegisterComponent<components::Parent>("Parent");
+        RegisterComponent<components::WorldTransform2D>("WorldTransform2D");
+        // Texture ID is valid only for the current Renderer2D resources, so it is not saved. Texture is prepared again from the path.
+        RegisterComponent<components::SpriteRenderer>("SpriteRenderer",
+            [](const components::SpriteRenderer& sprite, std::vector<uint8_t>& out) {
+                Write(out, sprite.image_path);
+                Write(out, sprite.color);
+            },
+            [](components::SpriteRenderer& sprite, const uint8_t* data, const uint8_t* end) {
+                data = Read(data, end, sprite.image_path);
+                return Read(data, end, sprite.color);
+            });
+        RegisterComponent<components::Children>("Children",
+            [](const components::Children& children, std::vector<uint8_t>& out) {
+                Write(out, uint32_t(children.entities.size()));
+                for (auto&& ent : children.entities)
+                    Write(out, ent);
+            },
+            [](components::Children& children, const uint8_t* data, const uint8_t* end) {
+                uint32_t count = 0;
+                data = Read(data, end, count);
+                // Check the count before allocating, as it comes from the file.
+                if (!data || size_t(end - data) / sizeof(EntityID) < count)
+                    return static_cast<const uint8_t*>(nullptr);
+                children.entities.resize(count);
+                for (auto&& ent : children.entities)
+                    data = Read(data, end, ent);
+                return data;
+            });
+    }
+    return s_registry;
+}
+void SceneSerializer::registerComponent(component_desc desc)
+{
+    auto& reg = registry();
+    auto it = std::find_if(reg.begin(), reg.end(), [&desc](const component_desc& d) { return d.name == desc.name || d.component_id == desc.component_id; });
+    if (it != reg.end())
+        *it = std::move(desc);
+    else
+        reg.push_back(std::move(desc));
+}
+
+
+// ======================
+// Save
+// ======================
+bool SceneSerializer::Save(Scene& scene, const char* filename)
+{
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        LOG_E("Failed to open scene file for writing: " + std::string(filename));
+        return false;
+    }
+
+    // Pick registered components, which have a pool in this scene.
+    std::vector<const component_desc*> columns;
+    for (auto&& desc : registry())
+        if (desc.component_id < (int)scene.mComponentPools.size() && scene.mComponentPools[desc.component_id])
+            columns.push_back(&desc);
+
+    file_header header{ { FILE_MAGIC[0], FILE_MAGIC[1], FILE_MAGIC[2], FILE_MAGIC[3] }, FORMAT_VERSION,
+        uint32_t(scene.mEntities.size()), uint32_t(scene.mFreeEntities.size()), uint32_t(columns.size()), 0 };
+    writeSection(file, &header, sizeof(header));
+
+    // Entity table.
+    std::vector<EntityID> ids(scene.mEntities.size());
+    for (size_t i = 0; i < ids.size(); i++)
+        ids[i] = scene.mEntities[i].id;
+    writeSection(file, ids.data(), ids.size() * sizeof(EntityID));
+    writeSection(file, scene.mFreeEntities.data(), scene.mFreeEntities.size() * sizeof(EntityIndex));
+
+    // Component columns.
+    std::vector<uint8_t> data;
+    for (auto&& desc : columns)
+    {
+        ComponentPool* pool = scene.mComponentPools[desc->component_id];
+        data.clear();
+        if (desc->save)
+        {
+            for (size_t i = 0; i < pool->size(); i++)
+                desc->save(pool->at(i), data);
+        }
+        else if (!pool->is_tag())
+        {
+            // Copy the column page by page.
+            data.reserve(pool->size() * pool->element_size);
+            for (size_t i = 0; i < pool->size(); i += POOL_PAGE_SIZE)
+            {
+                const uint8_t* p_page = static_cast<const uint8_t*>(pool->at(i));
+                data.insert(data.end(), p_page, p_page + std::min(POOL_PAGE_SIZE, pool->size() - i) * pool->element_size);
+            }
+        }
+
+        column_header col{ uint32_t(desc->name.size()), desc->save ? 0 : desc->element_size, uint32_t(pool->size()), desc->save ? 1u : 0u, data.size() };
+        writeSection(file, &col, sizeof(col));
+        writeSection(file, desc->name.data(), desc->name.size());
+        writeSection(file, pool->entities(), pool->size() * sizeof(EntityIndex));
+        writeSection(file, data.data(), data.size());
+    }
+
+    if (!file)
+    {
+        LOG_E("Failed writing scene file: " + std::string(filename));
+        return false;
+    }
+    return true;
+}
+
+
+// ======================
+// Load
+// ======================
+bool SceneSerializer::Load(Scene& scene, const char* filename)
+{
+    REN_ASSERT(scene.mEntities.empty(), "Scene can be loaded only into an empty scene.");
+
+    mapped_file mapping(filename);
+    if (!mapping.data)
+    {
+        LOG_E("Failed to map scene file: " + std::string(filename));
+        return false;
+    }
+    file_reader reader{ mapping.data, mapping.size };
+
+    file_header header;
+    const uint8_t* p_header = reader.section(sizeof(header));
+    if (!p_header)
+    {
+        LOG_E("Scene file is too small: " + std::string(filename));
+        return false;
+    }
+    std::memcpy(&header, p_header, sizeof(header));
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FORMAT_VERSION)
+    {
+        LOG_E("Unsupported scene file format or version: " + std::string(filename));
+        return false;
+    }
+
+    const uint8_t* p_ids = reader.section(size_t(header.entity_count) * sizeof(EntityID));
+    const uint8_t* p_free = reader.section(size_t(header.free_count) * sizeof(EntityIndex));
+    if (!p_ids || !p_free)
+    {
+        LOG_E("Scene file is truncated: " + std::string(filename));
+        return false;
+    }
+
+    // Free list is used by Scene::NewEntity() without any checks. Free slots must be unique and hold invalidated IDs
+    // (see Scene::DestroyEntity()), the rest of the slots have to hold IDs with their own index.
+    std::vector<EntityIndex> free_entities(header.free_count);
+    if (header.free_count)
+        std::memcpy(free_entities.data(), p_free, header.free_count * sizeof(EntityIndex));
+    std::vector<uint8_t> is_free(header.entity_count, 0);
+    for (auto&& index : free_entities)
+    {
+        if (index >= header.entity_count || is_free[index])
+        {
+            LOG_E("Scene file contains invalid or duplicate free entity index: " + std::string(filename));
+            return false;
+        }
+        is_free[index] = 1;
+    }
+    std::vector<EntityID> ids(header.entity_count);
+    if (header.entity_count)
+        std::memcpy(ids.data(), p_ids, ids.size() * sizeof(EntityID));
+    for (size_t i = 0; i < ids.size(); i++)
+        if (Utils::GetEntityIndex(ids[i]) != (is_free[i] ? EntityIndex(-1) : EntityIndex(i)))
+        {
+            LOG_E("Scene file contains entity ID, which doesn't match its index: " + std::string(filename));
+            return false;
+        }
+
+    // Restore entity table as is, so that the entity IDs stay the same.
+    scene.mEntities.resize(header.entity_count);
+    for (size_t i = 0; i < header.entity_count; i++)
+    {
+        scene.mEntities[i].id = ids[i];
+        scene.mEntities[i].mask.reset();
+    }
+    scene.mFreeEntities = std::move(free_entities);
+
+    // Pools created by this load. On failure, they are deleted and the rest of the pools are emptied,
+    // so that the scene is left empty as it was before.
+    std::vector<int> created_pools;
+    auto fail = [&scene, &created_pools]() {
+        for (int component_id : created_pools)
+        {
+            delete scene.mComponentPools[component_id];
+            scene.mComponentPools[component_id] = nullptr;
+        }
+        for (auto&& pool : scene.mComponentPools)
+            while (pool && pool->size())
+                pool->erase(pool->entities()[pool->size() - 1]);
+        scene.mEntities.clear();
+        scene.mFreeEntities.clear();
+        return false;
+    };
+
+    std::vector<EntityIndex> indices;
+    // Column, in which the entity was seen last. Used to find duplicate entity indices.
+    std::vector<uint32_t> seen_in(header.entity_count, 0);
+    for (uint32_t c = 0; c < header.column_count; c++)
+    {
+        column_header col;
+        const uint8_t* p_col = reader.section(sizeof(col));
+        if (!p_col)
+            break;
+        std::memcpy(&col, p_col, sizeof(col));
+        const uint8_t* p_name = reader.section(col.name_length);
+        const uint8_t* p_entities = reader.section(size_t(col.count) * sizeof(EntityIndex));
+        const uint8_t* p_data = reader.section(col.data_size);
+        if (!p_name || !p_entities || !p_data)
+        {
+            LOG_E("Scene file is truncated: " + std::string(filename));
+            return fail();
+        }
+
+        std::string name(reinterpret_cast<const char*>(p_name), col.name_length);
+        auto& reg = registry();
+        auto desc = std::find_if(reg.begin(), reg.end(), [&name](const component_desc& d) { return d.name == name; });
+        if (desc == reg.end() || bool(col.custom) != bool(desc->load) || (!col.custom && col.element_size != desc->element_size)
+            || (!col.custom && col.data_size != uint64_t(col.count) * col.element_size))
+        {
+            LOG_W("Skipping unknown or incompatible component column '" + name + "' in scene file: " + std::string(filename));
+            continue;
+        }
+
+        indices.resize(col.count);
+        if (col.count)
+            std::memcpy(indices.data(), p_entities, indices.size() * sizeof(EntityIndex));
+        if ((int)scene.mComponentPools.size() <= desc->component_id)
+            scene.mComponentPools.resize(desc->component_id + 1, nullptr);
+        ComponentPool*& pool = scene.mComponentPools[desc->component_id];
+        if (!pool)
+        {
+            pool = desc->create_pool();
+            created_pools.push_back(desc->component_id);
+        }
+
+        // Duplicate index within the column (or in a repeated column) would break the pool's dense arrays.
+        bool valid = std::all_of(indices.begin(), indices.end(), [&](EntityIndex i) {
+            if (i >= header.entity_count || is_free[i] || seen_in[i] == c + 1 || pool->contains(i))
+                return false;
+            seen_in[i] = c + 1;
+            return true;
+        });
+        if (!valid)
+        {
+            LOG_E("Scene file contains invalid or duplicate entity index in column '" + name + "': " + std::string(filename));
+            return fail();
+        }
+
+        if (desc->load)
+        {
+            const uint8_t* p_end = p_data + col.data_size;
+            for (auto&& index : indices)
+            {
+                p_data = desc->load(pool->insert(index, scene.mTick), p_data, p_end);
+                if (!p_data)
+                {
+                    LOG_E("Scene file contains invalid data in column '" + name + "': " + std::string(filename));
+                    return fail();
+                }
+            }
+        }
+        else
+            pool->insert_bulk(indices.data(), indices.size(), p_data, scene.mTick);
+
+        for (auto&& index : indices)
+            scene.mEntities[index].mask.set(desc->component_id);
+    }
+    // Masks were set directly, so the registered queries have to be filled now.
+    scene.refreshQueries();
+    return true;
+}
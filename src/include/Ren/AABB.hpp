@@ -0,0 +1,44 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <algorithm>    // std::min, std::max
+
+namespace Ren
+{
+    // Axis aligned bounding box in 2D. Max is inclusive.
+    struct AABB2D
+    {
+        glm::vec2 min{ 0.0f, 0.0f };
+        glm::vec2 max{ 0.0f, 0.0f };
+
+        inline glm::vec2 GetCenter() const { return 0.5f * (min + max); }
+        inline glm::vec2 GetSize() const { return max - min; }
+        inline bool Overlaps(const AABB2D& other) const
+        {
+            return min.x <= other.max.x && max.x >= other.min.x && min.y <= other.max.y && max.y >= other.min.y;
+        }
+        inline bool Contains(glm::vec2 point) const
+        {
+            return point.x >= min.x && point.x <= max.x && point.y >= min.y && point.y <= max.y;
+        }
+        // Squared distance from the point to the box. Is 0 if the point is inside.
+        inline float Distance2(glm::vec2 point) const
+        {
+            glm::vec2 d = glm::max(glm::max(min - point, point - max), glm::vec2(0.0f));
+            return glm::dot(d, d);
+        }
+
+        // Bounding box of quad (0, 0)-(size) transformed by 2x3 affine matrix.
+        static AABB2D FromTransformedQuad(const glm::mat3x2& matrix, glm::vec2 size)
+        {
+            glm::vec2 corners[4] = { matrix * glm::vec3(0.0f, 0.0f, 1.0f), matrix * glm::vec3(size.x, 0.0f, 1.0f),
+                                     matrix * glm::vec3(0.0f, size.y, 1.0f), matrix * glm::vec3(size, 1.0f) };
+            AABB2D box{ corners[0], corners[0] };
+            for (int i = 1; i < 4; i++)
+            {
+                box.min = glm::min(box.min, corners[i]);
+                box.max = glm::max(box.max, corners[i]);
+            }
+            return box;
+        }
+    };
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "Ren/Core.h"
 #include "Ren/InputInterface.hpp"
+#include "Ren/AABB.hpp"
 #include <glm/glm.hpp>
 
 
@@ -17,6 +18,8 @@ namespace Ren
         virtual bool CanSee(glm::vec2 point) = 0;
         virtual glm::mat4 GetProjection() = 0;
         virtual glm::mat4 GetView() = 0;
+        // Area of the world visible on the screen. Zoom scales the view, so larger zoom shows smaller area.
+        virtual AABB2D GetVisibleBounds() { return { m_cameraPosition, m_cameraPosition + m_screenSize / m_zoom }; }
 
         inline void SetPosition(const glm::vec2& pos) { m_cameraPosition = pos; }
         inline const glm::vec2& GetPosition() { return m_cameraPosition; }
@@ -37,7 +40,7 @@ namespace Ren
         void Init(const glm::vec2& screen_size) override
         {
             m_screenSize = screen_size;
-            m_cameraSize = m_screenSize * m_zoom;
+            m_cameraSize = m_screenSize / m_zoom;
         }
         void Update(InputInterface* input, float dt) override 
         {
@@ -54,11 +57,11 @@ namespace Ren
         void OnResize(const glm::vec2& new_screen_size) override
         {
             m_screenSize = new_screen_size;
-            m_cameraSize = m_screenSize * m_zoom;
+            m_cameraSize = m_screenSize / m_zoom;
         }
         bool CanSee(glm::vec2 point) override
         {
-            m_cameraSize = m_screenSize * m_zoom;
+            m_cameraSize = m_screenSize / m_zoom;
             return point.x >= m_cameraPosition.x && point.x < m_cameraPosition.x + m_cameraSize.x
                 && point.y >= m_cameraPosition.y && point.y < m_cameraPosition.y + m_cameraSize.y;
         }
@@ -3,6 +3,7 @@
 #include <glm/glm.hpp>
 #include <vector>
 #include "Ren/Renderer/OpenGL/Shader.h"
+#include "Ren/Renderer/RenderQueue.h"
 
 namespace Ren
 {
@@ -33,13 +34,20 @@ namespace Ren
 		void SetLineWidth(float width);
 		float GetLineWidth() const { return lineWidth; }
 		Shader GetShader() const { return shader;  }
+		// Record the draws into the queue instead of drawing them immediately. Pass nullptr to draw immediately again.
+		// Line width is global state, so the width set last is used for all queued lines.
+		void SetRenderQueue(RenderQueue* p_queue, uint32_t pass = 0, int32_t layer = 0);
 	private:
 		std::unordered_map<br_Shape, br_RenderInfo> mp_shape_info;
 		Shader shader;
 		float lineWidth;
 		unsigned int line_VBO = 0, line_VAO = 0;
+		RenderQueue* p_queue = nullptr;
+		uint64_t queue_key = 0;
 
 		void initShape(br_Shape shape);
 		void initLineBuffers();
+		void draw(unsigned int VAO, unsigned int mode, unsigned int count, const glm::mat4& model, glm::vec3 color);
+		void drawPolygon(const std::vector<glm::vec2>& points, const glm::mat4& model, glm::vec3 color);
 	};
 }
\ No newline at end of file
@@ -6,7 +6,8 @@
 
 namespace Ren
 {
-    enum class ShaderDataType : int { None = 0, Int, ivec2, ivec3, ivec4, Float, vec2, vec3, vec4, mat3, mat4 };
+    // ubyte4 is 4 unsigned bytes, which are read as vec4 in the shader (usually normalized, e.g. packed color).
+    enum class ShaderDataType : int { None = 0, Int, ivec2, ivec3, ivec4, Float, vec2, vec3, vec4, mat3, mat4, ubyte4 };
     struct BufferElement
     {
         ShaderDataType eType;
@@ -51,18 +52,32 @@ namespace Ren
         void Unbind();
         inline void SetLayout(const BufferLayout& layout) { mLayout = layout; }
         inline const BufferLayout& GetLayout() const { return mLayout; }
+        // Attributes of buffer with non-zero divisor advance once per divisor instances instead of once per vertex.
+        // Must be set before the buffer is added to vertex array.
+        inline void SetDivisor(uint32_t divisor) { mDivisor = divisor; }
+        inline uint32_t GetDivisor() const { return mDivisor; }
         inline uint32_t GetVertexCount() const { return mSize / sizeof(float); }
+        inline size_t GetSize() const { return mSize; }
         void UpdateData(uint32_t offset, uint32_t size, float* vertices) const;
+        // Map range of the buffer for writing. Previous content of the range is discarded.
+        // If unsynchronized, GL doesn't wait for draws still reading the buffer, so the caller must not write into ranges in use.
+        void* Map(uint32_t offset, uint32_t size, bool unsynchronized = false);
+        void Unmap();
+        // Allocate new storage of given size, discarding the content. Draws already issued keep reading the old storage (buffer orphaning).
+        void Orphan(size_t size);
 
         static Ref<VertexBuffer> Create(float* vertices, size_t size, BufferUsage usage = BufferUsage::StaticDraw);
     private:
         unsigned int mID;
         size_t mSize;
+        BufferUsage mUsage;
         BufferLayout mLayout;
+        uint32_t mDivisor = 0;
         
         VertexBuffer(float* vertices, size_t size, BufferUsage usage);
     };
 
+    enum class IndexType : int { UInt16 = 0, UInt32 };
     class ElementBuffer
     {
     public:
@@ -72,15 +87,22 @@ namespace Ren
         void Bind();
         void Unbind();
 
-        static Ref<ElementBuffer> Create(uint32_t* indexes, size_t size, BufferUsage usage = BufferUsage::StaticDraw);
+        static Ref<ElementBuffer> Create(const void* indexes, size_t size, BufferUsage usage = BufferUsage::StaticDraw, IndexType type = IndexType::UInt32);
 
         void UpdateData(uint32_t offset, uint32_t size, uint32_t* indices) const;
         inline uint32_t GetCount() { return mElementCount; }
+        inline size_t GetSize() const { return mSize; }
+        inline IndexType GetIndexType() const { return mIndexType; }
+        // OpenGL type of the indices, used by the draw calls.
+        uint32_t GetGLIndexType() const;
     private:
         unsigned int mID;
         size_t mSize;
         uint32_t mElementCount;
+        BufferUsage mUsage;
+        IndexType mIndexType;
 
-        ElementBuffer(uint32_t* indexes, size_t size, BufferUsage usage);
+        ElementBuffer(const void* indexes, size_t size, BufferUsage usage, IndexType type);
+        inline uint32_t indexSize() const { return mIndexType == IndexType::UInt16 ? sizeof(uint16_t) : sizeof(uint32_t); }
     };
 }
\ No newline at end of file
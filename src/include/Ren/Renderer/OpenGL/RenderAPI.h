@@ -15,9 +15,15 @@ namespace Ren
 
         static void DrawArrays(const Ref<VertexArray>& vao, uint32_t first, uint32_t count);
         static void DrawElements(const Ref<VertexArray>& vao, uint32_t count);
+        // Draw count indices starting at byte offset index_offset of the element buffer. base_vertex is added to every index.
+        static void DrawElementsBaseVertex(const Ref<VertexArray>& vao, uint32_t count, uint32_t index_offset, int32_t base_vertex);
+        // Draw instance_count instances of the first count indices.
+        static void DrawElementsInstanced(const Ref<VertexArray>& vao, uint32_t count, uint32_t instance_count);
         // Automatically decide, if what draw call should be called
         static void Draw(const Ref<VertexArray>& vao, uint32_t count = 0);
         static void SetActiveTextureUnit(uint32_t unit);
+        // Number of texture units, which can be used by the fragment shader.
+        static uint32_t GetMaxTextureUnits();
     private:
         inline static glm::ivec2 msViewportOffset = {0.0f, 0.0f};
         inline static glm::ivec2 msViewportSize = {0.0f, 0.0f};
@@ -48,6 +48,8 @@ namespace Ren
 		int32_t descriptor_id = 0;
 		glm::ivec2 offset = glm::vec2(0.0f);
 		glm::ivec2 size = glm::vec2(0.0f);
+		// Layer of the texture array, in which the texture is stored (see TextureBatch::UseTextureArray).
+		int32_t page = 0;
 
 		bool is_ready() { return ready_for_usage; }
 
@@ -77,6 +79,10 @@ namespace Ren
 	public:
 		bool SortBySize = false;
 		uint8_t ChannelCount = 4; // RGBA
+		// Store the batch as GL_TEXTURE_2D_ARRAY. Textures, which don't fit into the current page, are put into new page,
+		// which is stored as the next layer of the array. All pages have the same size.
+		// Must be set before adding the textures.
+		bool UseTextureArray = false;
 		
 		~TextureBatch();
 
@@ -97,6 +103,7 @@ namespace Ren
 		void Renew();
 
 		const TextureDescriptor& GetTextureDescriptor(int32_t id) { return mTextureDescriptors[id]; }
+		inline uint32_t GetPageCount() const { return mPageCount; }
 
 	protected:
 		struct prebuf_elem {
@@ -124,14 +131,23 @@ namespace Ren
 		bool mDirty = false;
 		uint32_t mMaxTextureWidth;
 		uint32_t mMaxTextureHeight;
+		uint32_t mMaxPages;
 		uint8_t mTextureMargin = 2;	// Two pixels margin.
+		// Number of pages. mLayers belong to the last one.
+		uint32_t mPageCount = 1;
+		// Size of the largest of the previous pages.
+		uint32_t mPagesWidth = 0, mPagesHeight = 0;
 
 		TextureBatch();
 
 		// Recursively using layering structure, set element offset in the batch texture.
 		bool insertToLayerAndSetOffset(uint32_t n_layer, const prebuf_elem& elem);
+		// Insert element into the current page, or into new page if the batch uses texture array.
+		bool insertTexture(const prebuf_elem& elem);
 		// Create 1px border around specified region. Border acts as WRAP TO EDGE.
-		void createBorder(glm::ivec2 offset, glm::ivec2 size);
+		void createBorder(glm::ivec2 offset, glm::ivec2 size, int32_t page);
+		// Create GL_TEXTURE_2D_ARRAY with mPageCount layers from data.
+		void generateArray(unsigned char* data);
 	};
 
 	namespace Utils
@@ -15,7 +15,11 @@ namespace Ren
 
         VertexArray& AddVertexBuffer(const Ref<VertexBuffer>& buf);
         VertexArray& SetElementBuffer(const Ref<ElementBuffer>& buf);
+        // Make attributes of the vertex buffer (by the order it was added) start at given byte offset of the buffer.
+        // Used for drawing instances from the middle of the buffer, as GL 3.3 has no base instance. Vertex array must be bound.
+        void SetVertexBufferOffset(uint32_t buffer_i, size_t offset);
 
+        inline uint32_t GetID() const { return mID; }
         inline const std::vector<Ref<VertexBuffer>>& GetVertexBuffers() const { return mVertexBuffers; }
         inline const Ref<ElementBuffer> GetElementBuffer() const { return mElementBuffer; }
 
@@ -25,5 +29,6 @@ namespace Ren
         Ref<ElementBuffer> mElementBuffer;
 
         VertexArray();
+        void setAttributePointers(VertexBuffer& buf, size_t offset);
     };
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+#include <cstdint>      // uint32_t, uint64_t, int32_t
+#include <cstring>      // std::memcpy
+#include <vector>       // std::vector
+#include <functional>   // std::function
+#include <type_traits>  // std::is_trivially_copyable_v
+#include <algorithm>    // std::clamp
+#include "Ren/Renderer/OpenGL/VertexArray.h"
+#include "Ren/Renderer/OpenGL/Shader.h"
+
+namespace Ren
+{
+    // Draw commands of a frame, recorded by the renderers and executed at once in the order of their sort keys.
+    // - Sort key (see MakeKey()) orders the commands by pass, layer, shader, texture and depth, so the commands
+    //   sharing the same state end up next to each other. Commands with equal keys keep the order of submission.
+    // - Shader, vertex array and texture are changed only when they differ from the previous command.
+    // - Uniforms of the draw are copied into the queue and set by their Apply(const Shader&) just before the draw.
+    // - Callbacks are recorded for the draws, which manage their own state (e.g. Renderer2D::Render()).
+    //   State is unknown after a callback, so the next command sets all of it again.
+    // - Shaders, textures and raw vertex arrays of the commands must stay alive until Flush().
+    class RenderQueue
+    {
+    public:
+        // Bit widths of the sort key parts: | pass | layer | shader | texture | depth |
+        static constexpr uint32_t PASS_BITS = 4, LAYER_BITS = 16, SHADER_BITS = 10, TEXTURE_BITS = 18, DEPTH_BITS = 16;
+        static constexpr uint32_t TEXTURE_2D = 0x0DE1;   // GL_TEXTURE_2D
+
+        struct DrawCommand
+        {
+            // Shader program. 0 unbinds the program.
+            uint32_t shader = 0;
+            // Vertex array drawn with glDrawArrays(mode, first, count).
+            uint32_t vao = 0;
+            uint32_t mode = 0;
+            uint32_t first = 0;
+            uint32_t count = 0;
+            // Texture bound to unit 0. 0 leaves the unit as it is.
+            uint32_t texture = 0;
+            uint32_t texture_target = TEXTURE_2D;
+        };
+        struct Stats
+        {
+            uint32_t commands = 0;
+            uint32_t callbacks = 0;
+            // State changes made during the last Flush(). Every other command reused the state of the previous one.
+            uint32_t shader_changes = 0;
+            uint32_t vertex_array_changes = 0;
+            uint32_t texture_changes = 0;
+        };
+
+        // Shader and texture are GL names. Only their low bits are used, which affects only the grouping, not the drawn state.
+        // Layer is clamped to 16 bits, depth orders the commands sharing the state (e.g. back to front).
+        static inline uint64_t MakeKey(uint32_t pass, int32_t layer, uint32_t shader = 0, uint32_t texture = 0, uint16_t depth = 0)
+        {
+            uint64_t sort_layer = uint16_t(int16_t(std::clamp<int32_t>(layer, INT16_MIN, INT16_MAX)) ^ 0x8000);
+            return uint64_t(pass & mask(PASS_BITS)) << (LAYER_BITS + SHADER_BITS + TEXTURE_BITS + DEPTH_BITS)
+                | sort_layer << (SHADER_BITS + TEXTURE_BITS + DEPTH_BITS)
+                | uint64_t(shader & mask(SHADER_BITS)) << (TEXTURE_BITS + DEPTH_BITS)
+                | uint64_t(texture & mask(TEXTURE_BITS)) << DEPTH_BITS
+                | uint64_t(depth);
+        }
+
+        void Submit(uint64_t key, const DrawCommand& draw);
+        // TUniforms must be trivially copyable and provide void Apply(const Shader&) const, which only sets the uniforms.
+        template<typename TUniforms>
+        void Submit(uint64_t key, const DrawCommand& draw, const TUniforms& uniforms)
+        {
+            command& cmd = push(key);
+            cmd.draw = draw;
+            setUniforms(cmd, uniforms);
+        }
+        // Draw the vertex array with RenderAPI::Draw(vao, draw.count), draw.vao and draw.mode are not used.
+        // The queue holds the reference until Flush().
+        void Submit(uint64_t key, const Ref<VertexArray>& vao, const DrawCommand& draw);
+        template<typename TUniforms>
+        void Submit(uint64_t key, const Ref<VertexArray>& vao, const DrawCommand& draw, const TUniforms& uniforms)
+        {
+            Submit(key, vao, draw);
+            setUniforms(mCommands.back(), uniforms);
+        }
+        void SubmitCallback(uint64_t key, std::function<void()> func);
+
+        // Sort and execute the commands, then clear the queue.
+        void Flush();
+        void Clear();
+        inline size_t Size() const { return mCommands.size(); }
+        inline const Stats& GetStats() const { return mStats; }
+
+    private:
+        static constexpr uint32_t NONE = uint32_t(-1);
+
+        struct command {
+            uint64_t key;
+            DrawCommand draw;
+            // Index into mVertexArrays or mCallbacks.
+            uint32_t vertex_array = NONE;
+            uint32_t callback = NONE;
+            // Offset of the uniforms in mUniforms.
+            uint32_t uniforms = 0;
+            void (*apply)(const Shader&, const uint8_t*) = nullptr;
+        };
+
+        std::vector<command> mCommands;
+        // Command indices sorted by their keys.
+        std::vector<uint32_t> mOrder;
+        std::vector<uint8_t> mUniforms;
+        std::vector<Ref<VertexArray>> mVertexArrays;
+        std::vector<std::function<void()>> mCallbacks;
+        Stats mStats;
+
+        static constexpr uint32_t mask(uint32_t bits) { return uint32_t((uint64_t(1) << bits) - 1); }
+        inline command& push(uint64_t key)
+        {
+            command& cmd = mCommands.emplace_back();
+            cmd.key = key;
+            return cmd;
+        }
+        template<typename TUniforms>
+        void setUniforms(command& cmd, const TUniforms& uniforms)
+        {
+            static_assert(std::is_trivially_copyable_v<TUniforms>, "Uniforms are copied into the queue as raw bytes.");
+            cmd.uniforms = uint32_t(mUniforms.size());
+            cmd.apply = [](const Shader& shader, const uint8_t* data) {
+                TUniforms uniforms;
+                std::memcpy(&uniforms, data, sizeof(TUniforms));
+                uniforms.Apply(shader);
+            };
+            const uint8_t* p_uniforms = reinterpret_cast<const uint8_t*>(&uniforms);
+            mUniforms.insert(mUniforms.end(), p_uniforms, p_uniforms + sizeof(TUniforms));
+        }
+    };
+}
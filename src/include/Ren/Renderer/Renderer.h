@@ -4,14 +4,23 @@
 #include "Ren/Renderer/OpenGL/Shader.h"
 #include "Ren/Core.h"
 #include "Ren/Renderer/OpenGL/Texture.h"
+#include "Ren/Renderer/RenderQueue.h"
 #include "Ren/Camera.h"
-#include <list>
+#include "Ren/ThreadPool.hpp"
+#include <vector>
+#include <memory>   // std::allocator
+#include <atomic>   // std::atomic
+#include <cstring>  // std::memcpy
+#include <algorithm>    // std::clamp
 
 namespace Ren
 {
     typedef int32_t TextureID;
     typedef int32_t Layer;
     #define TEXTURE_NONE TextureID(-1)
+    // Handle of retained sprite (see Renderer2D::CreateSprite()).
+    typedef int32_t SpriteID;
+    #define SPRITE_NONE SpriteID(-1)
 
     class Renderer2D
     {
@@ -23,7 +32,7 @@ namespace Ren
             // Rotation in degrees.
             float rotation = 0.0f;
 
-            glm::mat4 getModelMatrix();
+            glm::mat4 getModelMatrix() const;
             Transform(glm::vec2 position, glm::vec2 scale, float rotation = 0.0f) : position(position), scale(scale), rotation(rotation) {}
             Transform() = default;
         };
@@ -36,6 +45,14 @@ namespace Ren
             Material(glm::vec3 color, TextureID texture_id = -1) : color(glm::vec4(color, 1.0f)), texture_id(texture_id) {}
             Material() = default;
         };
+        struct QuadSubmission {
+            Transform transform;
+            Material material;
+            Layer layer = 0;
+            // Quads of the same layer are rendered by their order, then in the order they were submitted by the thread.
+            // Quads submitted from multiple threads should have unique order (e.g. entity index), so that their drawing order is deterministic.
+            uint32_t order = 0;
+        };
     private:
         struct Vertex 
         {
@@ -44,23 +61,102 @@ namespace Ren
             float tex_index = -1.0f;
             glm::vec4 color = glm::vec4(1.0f);
         };
-        struct QuadSubmission {
-            Transform transform;
-            Material material;
-            Layer layer = 0;
+        // Quad uploaded by the instanced path. The vertex shader expands it into the 4 corners of the unit quad.
+        struct QuadInstance
+        {
+            glm::vec2 position;
+            glm::vec2 scale;
+            float rotation;             // In degrees.
+            glm::vec4 uv_rect;          // Offset in xy, size in zw.
+            float tex_index;
+            uint32_t color;             // RGBA8, red in the lowest byte.
         };
+        // Quad to be rendered. Its 4 vertices are stored in the vertex arena at position 4 * (index of the primitive).
+        // Indices are not stored, as all quads share the same static index buffer.
         struct RenderPrimitive {
-            std::vector<Vertex> vertices;
-            std::vector<uint32_t> indices;
             Layer layer = 0;
             int32_t used_batch_i = -1;
+            // Order within the layer. QuadSubmission::order, or the sortable bits of the quad's bottom edge in SortMode::Y.
+            uint32_t order = 0;
+        };
+        // Render order of the primitive. Key is packed as:
+        // - bits 48-63: layer, biased to unsigned (layers are clamped to the 16-bit range)
+        // - bits 32-47: texture batch + 1 in SortMode::TextureBatch, 0 otherwise
+        // - bits 0-31:  order of the primitive
+        // Keys are sorted by stable radix sort, so the primitives with equal keys stay in the submission order.
+        struct sort_key {
+            uint64_t key;
+            uint32_t index;
         };
-        uint32_t mMaxQuads = 1000;      // Maxmimum number of quads to be rendered in single render pass.
+        uint32_t mMaxQuads = 1000;      // Initial capacity of the streaming buffers in quads. Buffers grow when a frame needs more.
+        uint32_t mMaxGroupQuads = 65536 / 4;    // Maximum number of quads rendered in single draw call. Limited by 16-bit indices.
         uint32_t mVBOSize = mMaxQuads * 4 * sizeof(Vertex);  // 4 vertices per quad
-        uint32_t mEBOSize = mMaxQuads * 6 * sizeof(uint32_t);
-        uint8_t mTexUnitsForUse = 12;       // Number of texture units to be used by user.
+        // Streaming buffers hold geometry of this many frames before they are orphaned.
+        static constexpr uint32_t STREAM_FRAMES = 3;
+        // Smallest number of quads processed by single worker. Frames with less quads are processed serially.
+        static constexpr uint32_t MIN_SLICE_QUADS = 4096;
+        // Number of texture samplers in the renderer's shaders.
+        static constexpr uint32_t SHADER_TEXTURE_SLOTS = 16;
+        // Number of texture batches single draw can use. Smaller of GL_MAX_TEXTURE_IMAGE_UNITS and SHADER_TEXTURE_SLOTS.
+        uint32_t mMaxTextureUnits = SHADER_TEXTURE_SLOTS;
         inline static Renderer2D* msInstance = nullptr;
+
+        // Allocator of the per-frame containers. Counts the allocations, so that the stats can show
+        // that the steady state rendering doesn't allocate.
+        inline static std::atomic<uint32_t> msAllocationCount{ 0 };
+        template<typename T>
+        struct counting_allocator {
+            typedef T value_type;
+            counting_allocator() = default;
+            template<typename U> counting_allocator(const counting_allocator<U>&) {}
+            T* allocate(size_t n) { msAllocationCount++; return std::allocator<T>().allocate(n); }
+            void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+            template<typename U> bool operator==(const counting_allocator<U>&) const { return true; }
+            template<typename U> bool operator!=(const counting_allocator<U>&) const { return false; }
+        };
+        // Container, which keeps its memory between the frames.
+        template<typename T>
+        using frame_vector = std::vector<T, counting_allocator<T>>;
     public:
+        // How the quads are uploaded to the GPU.
+        // - Vertices: 4 transformed vertices per quad (160 B), drawn with the shared index buffer.
+        // - Instanced: single QuadInstance per quad (44 B), transformed in the vertex shader.
+        enum class RenderPath { Vertices, Instanced };
+        // Order of the quads within the same layer.
+        // - Submission: by QuadSubmission::order, then in the order they were submitted.
+        // - TextureBatch: quads using the same texture batch are drawn together, which minimizes texture binds
+        //   and the number of draws, when the layer uses more texture batches than there are texture units.
+        //   Overlapping quads of the same layer can be drawn in different order than they were submitted.
+        // - Y: by the bottom edge of the quad (position.y + scale.y), so the lower quads are drawn over the upper ones.
+        // Only TextureBatch reorders the quads to reduce the texture unit splits. In the other modes the order is kept,
+        // so the draw is split every time the next quad needs a texture batch, which doesn't fit into the texture units
+        // together with the batches used since the last split (see Stats::texture_unit_splits). If the layer uses more
+        // texture batches than there are texture units, use TextureBatch or TextureMode::TextureArray to avoid the splits.
+        enum class SortMode { Submission, TextureBatch, Y };
+        // How the prepared textures are stored.
+        // - Atlases: 2D atlases bound to separate texture units. Draw is split, when it needs more atlases than there are units.
+        // - TextureArray: pages of a single GL_TEXTURE_2D_ARRAY, selected by the layer in the shader.
+        //   All textures are reachable from a single bind, so the texture batches never split the draws.
+        enum class TextureMode { Atlases, TextureArray };
+        struct Stats
+        {
+            // Quads, which passed the culling and were drawn, including the static ones.
+            uint32_t quad_count = 0;
+            // Quads drawn from the GPU buffers of the static layers.
+            uint32_t static_quad_count = 0;
+            // Retained sprites drawn and ranges of their buffers uploaded in the last frame.
+            uint32_t sprite_count = 0;
+            uint32_t sprite_upload_ranges = 0;
+            // Submitted quads outside of the camera's visible bounds.
+            uint32_t culled_count = 0;
+            uint32_t draw_calls = 0;
+            // Draw calls added, because groups used more texture batches than there are texture units.
+            // Frame would need draw_calls - texture_unit_splits draws without the limit.
+            uint32_t texture_unit_splits = 0;
+            // Heap allocations made by the renderer's frame containers during the last frame.
+            // Slices are dispatched to the thread pool without allocating in the steady state, so they are not counted.
+            uint32_t allocations = 0;
+        };
         static Renderer2D* GetInstance();
         static void DeleteInstance();
 
@@ -75,8 +171,50 @@ namespace Ren
 
         void BeginScene(Camera2D* camera);
         void EndScene();
-        void SubmitQuad(const Transform& trans, const Material& mat, int32_t layer = 0);
+        // Submission is thread-safe for the workers of renderer's thread pool (see SetThreadPool()) and single other thread,
+        // as each of them has its own submission buffer. Buffers are merged in Render(), which must be called after all submissions finished.
+        void SubmitQuad(const Transform& trans, const Material& mat, int32_t layer = 0, uint32_t order = 0);
+        void SubmitQuads(const QuadSubmission* p_quads, size_t count);
         void Render();
+        // Record the frame into the queue instead of drawing it. Geometry is uploaded now and every draw call becomes a command
+        // of its layer, so the quads are drawn between the commands of the other renderers by the layers.
+        // Draws of the renderer keep their order within the layer. Renderer must not be changed until the queue is flushed.
+        void Render(RenderQueue& queue, uint32_t pass = 0);
+        // Select the upload path. Can be changed between the frames.
+        inline void SetRenderPath(RenderPath path) { mRenderPath = path; }
+        inline RenderPath GetRenderPath() const { return mRenderPath; }
+        inline void SetSortMode(SortMode mode) { mSortMode = mode; }
+        inline SortMode GetSortMode() const { return mSortMode; }
+        // Skip quads outside of the camera's visible bounds (see Camera2D::GetVisibleBounds()). Enabled by default.
+        inline void SetCulling(bool enabled) { mCulling = enabled; }
+        inline bool IsCullingEnabled() const { return mCulling; }
+        // Static layers keep their geometry on the GPU. Quads submitted into the layer are built into its own buffer
+        // in the first frame after the layer was made static or invalidated, and the buffer is redrawn in the following frames.
+        // Quads submitted into already built layer are ignored, so they don't have to be submitted every frame (see IsStaticLayerBuilt()).
+        // Static quads are not culled and they are drawn before the dynamic quads of the same layer.
+        // Set of submissions can be made static by putting them into a layer of their own.
+        void SetLayerStatic(Layer layer, bool is_static = true);
+        bool IsLayerStatic(Layer layer) const;
+        bool IsStaticLayerBuilt(Layer layer) const;
+        // Drop built geometry of the static layer, so that it is built again from the quads submitted in the next frame.
+        void InvalidateStaticLayer(Layer layer);
+        void InvalidateStaticLayers();
+        // Retained sprites live in persistent slots of GPU buffers, so they are drawn without being submitted every frame.
+        // Only the slots of sprites changed since the last frame are uploaded, merged into few buffer ranges.
+        // - Sprites are drawn by single instanced draw per layer and group of texture units, before the dynamic quads of the same layer.
+        //   Order of the sprites within the layer is not defined.
+        // - Sprites are not culled. Retained API must be used from the thread calling Render().
+        SpriteID CreateSprite(const Transform& trans, const Material& mat, Layer layer = 0);
+        void UpdateSprite(SpriteID id, const Transform& trans, const Material& mat);
+        void DestroySprite(SpriteID id);
+        inline uint32_t GetSpriteCount() const { return mSpriteCount; }
+        // Select texture storage. Must be set before BeginPrepare(), as it applies to the textures prepared afterwards.
+        inline void SetTextureMode(TextureMode mode) { mTextureMode = mode; }
+        inline TextureMode GetTextureMode() const { return mTextureMode; }
+        // Set thread pool used for batching the quads. If nullptr, quads are batched serially.
+        // GL calls are always made from the calling thread. Must not be called while other threads submit quads.
+        void SetThreadPool(ThreadPool* p_pool);
+        inline ThreadPool* GetThreadPool() const { return mpThreadPool; }
         // Return texture batch, in which given texture resides.
         inline const Ref<TextureBatch>& GetTextureBatch(TextureID texture_id) const { return mTextures[mTextureMapping[texture_id].batch_i]; }
         TextureDescriptor GetTextureDescriptor(TextureID texture_id);
@@ -86,41 +224,252 @@ namespace Ren
         inline uint32_t GetIndexCount() { return mPrimitives.size() * 6; }
         inline uint32_t GetTextureCount() { return mTextureMapping.size(); }
         inline uint32_t GetBatchCount() { return mTextures.size(); }
+        // Statistics of the last rendered frame.
+        inline const Stats& GetStats() const { return mStats; }
     protected:
         Shader mShader;
-        void* mpBuffer;      // Buffer used for temporary storing data, before sent to gpu.
-        std::vector<RenderPrimitive> mPrimitives;
-        std::vector<QuadSubmission> mQuadSubmissions;
+        Shader mInstancedShader;
+        // Shaders sampling from the texture array, used in TextureMode::TextureArray.
+        Shader mArrayShader;
+        Shader mInstancedArrayShader;
+        RenderPath mRenderPath = RenderPath::Vertices;
+        SortMode mSortMode = SortMode::Submission;
+        TextureMode mTextureMode = TextureMode::Atlases;
+        bool mCulling = true;
+        // Visible bounds of the scene's camera.
+        AABB2D mVisibleBounds;
+        // Primitives in the order of submission.
+        frame_vector<RenderPrimitive> mPrimitives;
+        // Vertices of all primitives, 4 per primitive. Used by the vertex path.
+        frame_vector<Vertex> mVertices;
+        // Instances of all primitives, 1 per primitive. Used by the instanced path.
+        frame_vector<QuadInstance> mInstances;
+        // Render order of the primitives.
+        frame_vector<sort_key> mSortKeys;
+        // Output of the radix sort passes.
+        frame_vector<sort_key> mSortScratch;
+        // Submissions of every thread. Merged into mQuadSubmissions at the start of Render().
+        std::unique_ptr<PerThread<frame_vector<QuadSubmission>>> mSubmissionBuffers;
+        frame_vector<QuadSubmission> mQuadSubmissions;
+        // Submissions, which passed the culling. Slice writes the indices of its visible submissions from its beginning.
+        frame_vector<uint32_t> mVisibleSubmissions;
+        // Submissions culled in the last frame.
+        uint32_t mCulledCount = 0;
+        Stats mStats;
+        uint32_t mFrameAllocationStart = 0;
+        ThreadPool* mpThreadPool = &ThreadPool::Get();
         Ref<VertexArray> mQuadVAO;
+        // Write position in the streaming vertex buffer.
+        // Everything before it may still be read by the GPU, so it is never overwritten until the buffer is orphaned.
+        uint32_t mVBOHead = 0;
+        // Unit quad corners in the first buffer and streaming instances in the second one. Shares index buffer with mQuadVAO.
+        Ref<VertexArray> mInstanceVAO;
+        uint32_t mInstanceHead = 0;
         glm::mat4 mPV;
 
         // Textures
         struct batch_tex_desc { uint32_t batch_i, desc_i; TextureID texture_id = TEXTURE_NONE; }; // Include texture_id as well, to check for deleted textures.
         std::vector<batch_tex_desc> mTextureMapping;    // Mapping of texture IDs to their corresponding batch and texture descriptor.
+        // Normalized texture coordinates of the texture in its batch and the page (array layer) it is stored in.
+        // Untextured quads use the whole [0, 1] range with batch and page -1.
+        struct texture_uv { glm::vec4 uv_rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f); int32_t batch_i = -1; int32_t page = -1; };
+        // UVs of all textures indexed by the texture ID, so that batching doesn't have to look up the descriptors.
+        // Built in EndPrepare() and after the batch is renewed.
+        std::vector<texture_uv> mTextureUVs;
         std::vector<Ref<TextureBatch>> mTextures;
         bool mPreparing;
 
         Renderer2D();
 
         // ===> Render group optimizations and rendering groups. <=== //
-        // render group represents randge of primitives, witch will be rendered during single render pass.
+        // render group represents randge of primitives (positions in mSortKeys), witch will be rendered during single render pass.
         struct render_group { 
             uint32_t mPrimitives_start, mPrimitives_end; 
-            std::vector<uint32_t> used_batches;
+            // Range of texture batches used by the group in mGroupBatches.
+            uint32_t batches_start = 0, batches_count = 0;
+        };
+        frame_vector<render_group> mRenderGroups;
+        // Used for building the new list of groups, when splitting them.
+        frame_vector<render_group> mSplitGroups;
+        frame_vector<uint32_t> mGroupBatches;
+        // Texture unit of the primitive at given position of the render order (index of its batch in the group's batches), -1 if untextured.
+        frame_vector<int32_t> mTextureSlots;
+        uint32_t mTextureUnitSplits = 0;
+
+        // Geometry of single static layer. Groups index vertices of the layer's buffer and batches in the layer's batches.
+        struct static_layer {
+            Layer layer;
+            bool built = false;
+            Ref<VertexArray> vao;
+            std::vector<render_group> groups;
+            std::vector<uint32_t> batches;
+            uint32_t quad_count = 0;
+
+            explicit static_layer(Layer layer) : layer(layer) {}
         };
-        std::list<render_group> mRenderGroups;
+        // Sorted by the layer.
+        std::vector<static_layer> mStaticLayers;
+        // Submissions of the static layers, which are built in this frame.
+        frame_vector<QuadSubmission> mStaticSubmissions;
+        // Vertices of the static layers in the render order. Used only while building them.
+        frame_vector<Vertex> mStaticVertices;
+        uint32_t mStaticDrawCalls = 0, mStaticQuadCount = 0;
+
+        // Slots of the sprites of single layer and group of texture batches, which can be bound at once.
+        // Slots are kept dense, so they are drawn by single instanced draw.
+        struct sprite_bucket {
+            Layer layer;
+            uint32_t texture_group;
+            Ref<VertexArray> vao;
+            // Copy of the buffer's content and sprite in every slot.
+            std::vector<QuadInstance> instances;
+            std::vector<SpriteID> owners;
+            // Slots changed since the last upload. Flag prevents adding the slot twice.
+            std::vector<uint32_t> dirty;
+            std::vector<uint8_t> dirty_flags;
+            // Buffer has to be reallocated and uploaded whole.
+            bool grown = false;
+
+            sprite_bucket(Layer layer, uint32_t texture_group) : layer(layer), texture_group(texture_group) {}
+        };
+        struct sprite {
+            Transform transform;
+            Material material;
+            Layer layer = 0;
+            sprite_bucket* p_bucket = nullptr;
+            uint32_t slot = 0;
+        };
+        // Initial number of slots of the bucket's buffer.
+        static constexpr uint32_t SPRITE_BUCKET_SLOTS = 256;
+        // Dirty slots closer than this are uploaded by single range. Uploading few clean slots is cheaper than another call.
+        static constexpr uint32_t SPRITE_MERGE_GAP = 32;
+        std::vector<sprite> mSprites;
+        std::vector<SpriteID> mFreeSprites;
+        uint32_t mSpriteCount = 0;
+        // Sorted by the layer and texture group. Buckets don't move, as the sprites point to them.
+        std::vector<std::unique_ptr<sprite_bucket>> mSpriteBuckets;
+        uint32_t mSpriteUploadRanges = 0, mSpriteDrawCount = 0;
+        // Sort layers, at which the dynamic groups have to be split.
+        frame_vector<uint32_t> mLayerSplits;
+        // Primitive at given position of the render order.
+        inline uint32_t primitiveAt(uint32_t pos) const { return mSortKeys[pos].index; }
+
+        // Range of items processed by single worker. count is the size of slice's output and offset its position,
+        // which is prefix sum of the output sizes of the previous slices.
+        struct batch_slice { uint32_t begin, end, offset, count; };
+        frame_vector<batch_slice> mSlices;
+        // Split count items into slices for the workers.
+        void buildSlices(uint32_t count);
+        // Call func(batch_slice&) for every slice in mSlices on the thread pool and wait for them.
+        template<typename TFunc>
+        void runSlices(TFunc&& func);
+
+        // Append submission buffers of all threads to mQuadSubmissions.
+        void mergeSubmissions();
         // Create primitives from QuadSubmissions and batch them together into one buffer.
         void batchPrimitives();
-        // Sort primitives in corresponding order, based on their layer.
+        // Move submissions of the static layers, which are not built, into mStaticSubmissions. Drop the rest of the static submissions.
+        void splitStaticSubmissions();
+        // Run mStaticSubmissions through the pipeline and upload the vertices of every layer into its buffer.
+        void buildStaticLayers();
+        // Position in the static layers and sprite buckets, which are drawn between the dynamic groups.
+        struct retained_cursor { size_t static_i = 0, bucket_i = 0; };
+        // Draw built static layers and sprite buckets from the cursor up to given sortLayer() (inclusive).
+        // Returns true, if anything was drawn. The caller has to bind its shader and vertex array again after that.
+        bool drawRetained(retained_cursor& cursor, uint32_t up_to_sort_layer, int32_t* bound);
+        void drawStaticLayer(const static_layer& layer, int32_t* bound);
+        void drawSpriteBucket(const sprite_bucket& bucket, int32_t* bound);
+        // Index of the static layer in mStaticLayers, or mStaticLayers.size() if the layer is not static.
+        size_t findStaticLayer(Layer layer) const;
+
+        // Draw call recorded by Render(RenderQueue&, ...) and executed by the queue's callback.
+        // Quads are drawn from the base vertex first, or as instances starting at byte offset first of the instance buffer.
+        struct queued_draw {
+            const Shader* p_shader;
+            Ref<VertexArray> vao;
+            bool instanced;
+            uint32_t first, quad_count;
+            // Range of the draw's texture batches in mQueuedBatches.
+            uint32_t batches_start, batches_count;
+        };
+        // Queue of the frame being recorded, nullptr when drawing immediately.
+        RenderQueue* mpQueue = nullptr;
+        uint32_t mQueuePass = 0;
+        frame_vector<queued_draw> mQueuedDraws;
+        frame_vector<uint32_t> mQueuedBatches;
+        // Record the draw under its layer. Batches are copied, as the state of the units is unknown when the command is executed.
+        void queueDraw(Layer layer, queued_draw draw, const uint32_t* p_batches);
+        void drawQueued(const queued_draw& draw);
+
+        // Put the sprite into a slot of the bucket of its layer and texture group.
+        void insertSprite(SpriteID id);
+        // Free the sprite's slot. Last slot of the bucket is moved into its place.
+        void eraseSprite(SpriteID id);
+        // Reinsert all sprites, as their texture batches changed.
+        void refreshSprites();
+        // Upload dirty slots of all buckets.
+        void uploadSprites();
+        // Texture index of the sprite's instance. Page of the texture array, or unit of its batch within the bucket's texture group.
+        inline float spriteTexIndex(const texture_uv& uv) const
+        {
+            if (mTextureMode == TextureMode::TextureArray)
+                return float(uv.page);
+            return uv.batch_i < 0 ? -1.0f : float(uint32_t(uv.batch_i) % getGroupTextureLimit());
+        }
+        inline void markSpriteSlot(sprite_bucket& bucket, uint32_t slot)
+        {
+            if (bucket.dirty_flags[slot])
+                return;
+            bucket.dirty_flags[slot] = 1;
+            bucket.dirty.push_back(slot);
+        }
+        // Collect visible submissions of the slice into mVisibleSubmissions and set slice's count.
+        void cullSlice(batch_slice& slice);
+        // Create primitives of the visible submissions in the slice.
+        void batchSlice(const batch_slice& slice);
+        void fillInstance(QuadInstance& instance, const Transform& trans, const Material& mat, const glm::vec4& uv_rect, float tex_index) const;
+        inline uint32_t primitiveOrder(const QuadSubmission& quad_sub) const
+        {
+            if (mSortMode != SortMode::Y)
+                return quad_sub.order;
+            // Flip the float bits, so that they compare as unsigned integers in the same order as the floats.
+            uint32_t bits;
+            float bottom = quad_sub.transform.position.y + quad_sub.transform.scale.y;
+            std::memcpy(&bits, &bottom, sizeof(bits));
+            return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+        }
+        void updateTextureUVs();
+        inline const texture_uv& getTextureUV(TextureID texture_id) const
+        {
+            static const texture_uv untextured;
+            return texture_id >= 0 && texture_id < TextureID(mTextureUVs.size()) ? mTextureUVs[texture_id] : untextured;
+        }
+        // Sort primitives in corresponding order, based on their layer. Groups are split at the built static layers,
+        // so that those can be drawn between them.
         void groupByLayers();
+        // Layer as it is stored in the sort key. Clamped to the 16-bit range and biased to unsigned.
+        static inline uint32_t sortLayer(Layer layer) { return uint16_t(int16_t(std::clamp<Layer>(layer, INT16_MIN, INT16_MAX)) ^ 0x8000); }
+        // Layers with at most this many distinct values (and equal rest of the keys) are sorted by single counting sort pass.
+        static constexpr uint32_t COUNTING_SORT_MAX_LAYERS = 256;
+        // Stable sort of mSortKeys in linear time.
+        void sortKeys();
+        // Split groups, which use more texture batches than there are texture units.
         void groupByMaxTextures();
         void groupBySize();
-        // Set correct offset of indices for each primitive. Must be done as almost last step,
-        // because if the primitive order changes after this function, then the indices 
-        // will become invalid and inrecoverable.
-        void offsetIndices();
-        // Render all render groups.
+        // Collect texture batches used by each group and assign texture units to the primitives.
+        void collectGroupBatches();
+        // Write geometry of all render groups into the streaming buffers and render them.
         void renderGroups();
+        void renderGroupsInstanced();
+        // Bind texture batches of the group to texture units. Units, which already hold the batch, are skipped.
+        // bound holds the batch of every unit and is kept between the groups of the frame.
+        void bindGroupTextures(const uint32_t* p_batches, uint32_t batch_count, int32_t* bound);
+        // Texture batches single draw can use.
+        inline uint32_t getGroupTextureLimit() const { return mTextureMode == TextureMode::TextureArray ? 1 : mMaxTextureUnits; }
+        // Reserve size bytes in the streaming buffer and return their offset. head is the write position in the buffer.
+        // When the rest of the buffer is too small, it is orphaned and writing starts again from its beginning.
+        template<typename TBuffer>
+        uint32_t reserveStream(TBuffer& buffer, uint32_t& head, uint32_t size, uint32_t alignment);
     };
 
 
@@ -129,13 +478,47 @@ namespace Ren
     {
     public:
         // Set scene parameters, like: Projection * view, light sources, camera position, etc.
+        // Commands submitted between BeginScene() and EndScene() are stored in the queue, which is flushed by EndScene().
         static void BeginScene();
         static void EndScene();
 
-        // Submit render command. Rigth now, the render call is called directly
-        // however in the future, the render calls should be stored in a queue
-        // then evaluated (optimizations such as batching) and then rendered.
+        // Draw the vertex array immediately with the shader currently in use.
         static void Submit(const Ref<VertexArray>& vao);
+        // Draw the vertex array with given shader and texture bound to unit 0 (none keeps the bound one).
+        // During the scene, the draw is queued under the key (see RenderQueue::MakeKey()) and executed by EndScene(),
+        // so everything the draw depends on has to be passed here. Outside of the scene, it is drawn immediately.
+        static void Submit(const Ref<VertexArray>& vao, const Shader& shader, uint64_t key, const Texture2D* p_texture = nullptr);
+        // Uniforms are copied and set just before the draw (see RenderQueue::Submit()).
+        template<typename TUniforms>
+        static void Submit(const Ref<VertexArray>& vao, const Shader& shader, const TUniforms& uniforms, uint64_t key, const Texture2D* p_texture = nullptr)
+        {
+            if (msInScene)
+            {
+                msQueue.Submit(key, vao, getDrawCommand(shader, p_texture), uniforms);
+                return;
+            }
+            shader.Use();
+            uniforms.Apply(shader);
+            draw(vao, p_texture);
+        }
+        // Queue shared by the renderers during the scene (see BasicRenderer::SetRenderQueue() and others).
+        static inline RenderQueue& GetQueue() { return msQueue; }
+    private:
+        inline static RenderQueue msQueue;
+        inline static bool msInScene = false;
+
+        static void draw(const Ref<VertexArray>& vao, const Texture2D* p_texture);
+        static inline RenderQueue::DrawCommand getDrawCommand(const Shader& shader, const Texture2D* p_texture)
+        {
+            RenderQueue::DrawCommand cmd;
+            cmd.shader = shader.ID;
+            if (p_texture)
+            {
+                cmd.texture = p_texture->ID;
+                cmd.texture_target = p_texture->BindTarget;
+            }
+            return cmd;
+        }
     };
 
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "Ren/Renderer/OpenGL/Shader.h"
 #include "Ren/Renderer/OpenGL/Texture.h"
+#include "Ren/Renderer/RenderQueue.h"
 #include <glm/glm.hpp>
 
 namespace Ren::Legacy
@@ -28,11 +29,20 @@ namespace Ren::Legacy
 		SpriteRenderer& RenderGLTexture(unsigned int ID, glm::vec2 vPosition, glm::vec2 vSize, float fRotate, glm::vec3 vColor, bool bFlipH = false, bool bFlipV = false);
 
 		Shader GetShader() const { return shader; };
-		SpriteRenderer& ForceColor(bool b) { shader.SetInt("force_color", int(b), true); return *this; }
+		// Applies to the sprites rendered after the call, queued sprites keep the value they were rendered with.
+		SpriteRenderer& ForceColor(bool b) { force_color = b; return *this; }
+		// Record the sprites into the queue instead of drawing them immediately. Pass nullptr to draw immediately again.
+		// Queued sprites are grouped by their textures within the layer.
+		void SetRenderQueue(RenderQueue* p_queue, uint32_t pass = 0, int32_t layer = 0);
 	private:
 		Shader shader;
 		unsigned int quadVAO;
+		RenderQueue* p_queue = nullptr;
+		uint32_t queue_pass = 0;
+		int32_t queue_layer = 0;
+		bool force_color = false;
 
 		void initRenderData();
+		void draw(unsigned int texture, unsigned int target, const glm::mat4& model, glm::vec3 color, glm::vec4 scale_offset, glm::ivec2 inverse_tex);
 	};
 }
\ No newline at end of file
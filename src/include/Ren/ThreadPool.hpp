@@ -0,0 +1,231 @@
+#pragma once
+#include <cstdint>              // uint32_t
+#include <vector>               // std::vector
+#include <memory>               // std::unique_ptr
+#include <thread>               // std::thread
+#include <atomic>               // std::atomic
+#include <mutex>                // std::mutex, std::unique_lock
+#include <condition_variable>   // std::condition_variable
+#include <functional>           // std::function
+#include <algorithm>            // std::max
+
+namespace Ren
+{
+    // Work-stealing pool of worker threads executing submitted tasks.
+    // - Every worker has its own task queue. Tasks submitted from a worker go to its own queue and are taken from the back (LIFO),
+    //   tasks submitted from other threads go to the shared queue. Idle workers steal from the front of other queues.
+    // - Thread which waits for the tasks (see WaitUntil()) helps with executing them, so the pool
+    //   can be used even from within its own tasks without deadlocking.
+    class ThreadPool
+    {
+    public:
+        typedef std::function<void()> Task;
+
+        // Create pool with given number of worker threads. When 0 workers are requested,
+        // all tasks are executed by the thread calling WaitUntil().
+        explicit ThreadPool(uint32_t worker_count = DefaultWorkerCount())
+        {
+            // Last queue is shared by all threads that are not workers of this pool.
+            for (uint32_t i = 0; i < worker_count + 1; i++)
+                mQueues.emplace_back(new task_queue());
+            for (uint32_t i = 0; i < worker_count; i++)
+                mWorkers.emplace_back([this, i] { workerLoop(i); });
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mSleepMutex);
+                mStop = true;
+            }
+            mTaskCv.notify_all();
+            for (auto&& worker : mWorkers)
+                worker.join();
+        }
+
+        // Engine-wide pool shared by the ECS and renderers.
+        static ThreadPool& Get()
+        {
+            static ThreadPool s_pool;
+            return s_pool;
+        }
+        // One worker per hardware thread, except the one used by the main thread.
+        static uint32_t DefaultWorkerCount() { return std::max(1u, std::thread::hardware_concurrency()) - 1; }
+
+        inline uint32_t GetWorkerCount() const { return uint32_t(mWorkers.size()); }
+        // Number of threads that can execute tasks of this pool at the same time (workers + the waiting thread).
+        inline uint32_t GetThreadCount() const { return GetWorkerCount() + 1; }
+        // Index of the calling thread in range [0, GetThreadCount()). Threads which are not workers of this pool share the last index.
+        inline uint32_t GetThreadIndex() const { return msCurrentPool == this ? msCurrentIndex : GetWorkerCount(); }
+
+        void Submit(Task task)
+        {
+            task_queue& queue = *mQueues[GetThreadIndex()];
+            {
+                std::unique_lock<std::mutex> lock(queue.mutex);
+                queue.push_back(std::move(task));
+            }
+            mPendingCount++;
+            // Lock, so that sleeping thread can't miss the notification between checking its predicate and going to sleep.
+            { std::unique_lock<std::mutex> lock(mSleepMutex); }
+            mTaskCv.notify_one();
+            mDoneCv.notify_all();
+        }
+        // Execute pending tasks on the calling thread until done() returns true.
+        // - done() is also called while holding pool's lock, so it should only read atomics.
+        template<typename TPredicate>
+        void WaitUntil(TPredicate&& done)
+        {
+            uint32_t index = GetThreadIndex();
+            while (!done())
+            {
+                Task task;
+                if (tryPop(index, task))
+                {
+                    runTask(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(mSleepMutex);
+                mDoneCv.wait(lock, [&] { return done() || mPendingCount > 0; });
+            }
+        }
+
+    private:
+        // Double-ended queue in a ring buffer. Unlike std::deque, it keeps its memory, so the steady state submitting doesn't allocate.
+        struct task_queue {
+            std::mutex mutex;
+            // Size is zero or power of two.
+            std::vector<Task> tasks;
+            size_t head = 0, count = 0;
+
+            inline bool empty() const { return count == 0; }
+            void push_back(Task&& task)
+            {
+                if (count == tasks.size())
+                {
+                    std::vector<Task> grown(std::max<size_t>(16, tasks.size() * 2));
+                    for (size_t i = 0; i < count; i++)
+                        grown[i] = std::move(tasks[(head + i) & (tasks.size() - 1)]);
+                    tasks.swap(grown);
+                    head = 0;
+                }
+                tasks[(head + count++) & (tasks.size() - 1)] = std::move(task);
+            }
+            inline Task pop_back() { return std::move(tasks[(head + --count) & (tasks.size() - 1)]); }
+            inline Task pop_front()
+            {
+                Task task = std::move(tasks[head]);
+                head = (head + 1) & (tasks.size() - 1);
+                count--;
+                return task;
+            }
+        };
+        std::vector<std::unique_ptr<task_queue>> mQueues;
+        std::vector<std::thread> mWorkers;
+        // Number of tasks waiting in all queues.
+        std::atomic<uint32_t> mPendingCount{ 0 };
+        std::mutex mSleepMutex;
+        // Signaled when new task is submitted or when the pool is stopping. Used by idle workers.
+        std::condition_variable mTaskCv;
+        // Signaled when task finishes or is submitted. Used by waiting threads.
+        std::condition_variable mDoneCv;
+        bool mStop{ false };
+
+        // Pool and index of the worker running on the current thread.
+        inline static thread_local const ThreadPool* msCurrentPool = nullptr;
+        inline static thread_local uint32_t msCurrentIndex = 0;
+
+        void workerLoop(uint32_t index)
+        {
+            msCurrentPool = this;
+            msCurrentIndex = index;
+            while (true)
+            {
+                Task task;
+                if (tryPop(index, task))
+                {
+                    runTask(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(mSleepMutex);
+                mTaskCv.wait(lock, [this] { return mStop || mPendingCount > 0; });
+                if (mStop && mPendingCount == 0)
+                    return;
+            }
+        }
+        // Take task from own queue or steal one from the other queues.
+        bool tryPop(uint32_t index, Task& task)
+        {
+            if (mPendingCount == 0)
+                return false;
+
+            {
+                task_queue& own = *mQueues[index];
+                std::unique_lock<std::mutex> lock(own.mutex);
+                if (!own.empty())
+                {
+                    task = own.pop_back();
+                    mPendingCount--;
+                    return true;
+                }
+            }
+            for (uint32_t i = 1; i < mQueues.size(); i++)
+            {
+                task_queue& victim = *mQueues[(index + i) % mQueues.size()];
+                std::unique_lock<std::mutex> lock(victim.mutex);
+                if (!victim.empty())
+                {
+                    task = victim.pop_front();
+                    mPendingCount--;
+                    return true;
+                }
+            }
+            return false;
+        }
+        void runTask(Task& task)
+        {
+            task();
+            { std::unique_lock<std::mutex> lock(mSleepMutex); }
+            mDoneCv.notify_all();
+        }
+    };
+
+    // Holds one value for every thread of the pool, so that tasks can accumulate results without locking.
+    // Each value is on its own cache line to avoid false sharing.
+    // Example:
+    //     PerThread<int> counts;
+    //     view.ParallelEach([&](EntityID id, const Health& h) { if (h.value <= 0) counts.Local()++; });
+    //     int total = 0; for (auto&& c : counts) total += c;
+    template<typename T>
+    class PerThread
+    {
+        struct alignas(64) slot { T value; };
+    public:
+        explicit PerThread(ThreadPool& pool = ThreadPool::Get())
+            : mpPool(&pool)
+            , mSlots(pool.GetThreadCount()) {}
+        PerThread(ThreadPool& pool, const T& initial)
+            : mpPool(&pool)
+            , mSlots(pool.GetThreadCount(), slot{ initial }) {}
+
+        // Value belonging to the calling thread.
+        inline T& Local() { return mSlots[mpPool->GetThreadIndex()].value; }
+        // Pool, whose threads have their own values. Threads outside of it share one value.
+        inline ThreadPool& GetPool() const { return *mpPool; }
+
+        struct Iterator
+        {
+            typename std::vector<slot>::iterator it;
+            inline T& operator*() const { return it->value; }
+            inline Iterator& operator++() { ++it; return *this; }
+            inline bool operator!=(const Iterator& rhs) const { return it != rhs.it; }
+        };
+        inline Iterator begin() { return { mSlots.begin() }; }
+        inline Iterator end() { return { mSlots.end() }; }
+
+    private:
+        ThreadPool* mpPool;
+        std::vector<slot> mSlots;
+    };
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>      // uint8_t, uint32_t
+#include <cstddef>      // std::max_align_t
+#include <vector>       // std::vector
+#include <memory>       // std::unique_ptr
+#include <utility>      // std::move
+#include <type_traits>  // std::is_empty_v
+#include <new>          // placement new
+#include <algorithm>    // std::max, std::stable_sort
+#include "Scene.hpp"
+
+namespace Ren::ecs
+{
+    // Records structural changes of the scene (creating and destroying entities, assigning and removing components),
+    // so that they can be applied later at a safe point, e.g. after the SceneView iteration or after all systems were updated.
+    // - Buffer itself is not thread-safe. Each thread should record into its own buffer (see SystemsManager::GetCommandBuffer()).
+    // - NewEntity() returns placeholder ID, which can be used in the following commands of the same buffer.
+    //   Placeholders are resolved to real entities during Playback().
+    class EntityCommandBuffer
+    {
+    public:
+        EntityCommandBuffer() = default;
+        EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+        EntityCommandBuffer& operator=(const EntityCommandBuffer&) = delete;
+        ~EntityCommandBuffer() { Clear(); }
+
+        // Record creation of new entity. Returns placeholder ID valid only within this buffer.
+        EntityID NewEntity()
+        {
+            EntityID placeholder = Utils::CreateEntityID(PLACEHOLDER_BIT | mCreatedCount++, 0);
+            mCommands.push_back({ command_type::NewEntity, placeholder });
+            return placeholder;
+        }
+        void DestroyEntity(EntityID id)
+        {
+            mCommands.push_back({ command_type::DestroyEntity, id });
+        }
+        // Record assigning of the component. Component is moved into the scene during the playback.
+        template<typename TComponent>
+        void Assign(EntityID id, TComponent component = TComponent())
+        {
+            command cmd{ command_type::Assign, id, Utils::GetId<TComponent>(), &applyRun<TComponent> };
+            if constexpr (!std::is_empty_v<TComponent>)
+            {
+                static_assert(alignof(TComponent) <= alignof(std::max_align_t), "Over-aligned components are not supported.");
+                cmd.payload = new(allocatePayload(sizeof(TComponent), alignof(TComponent))) TComponent(std::move(component));
+                cmd.destroy = [](void* payload) { static_cast<TComponent*>(payload)->~TComponent(); };
+            }
+            mCommands.push_back(cmd);
+        }
+        template<typename TComponent>
+        void Remove(EntityID id)
+        {
+            mCommands.push_back({ command_type::Remove, id, Utils::GetId<TComponent>(), &applyRun<TComponent> });
+        }
+
+        inline bool Empty() const { return mCommands.empty(); }
+        inline size_t GetCommandCount() const { return mCommands.size(); }
+
+        // Apply all recorded commands to the scene and clear the buffer.
+        // - All entities created by this buffer are created first in one go, so placeholders can be resolved while applying the rest.
+        // - Assign and Remove commands are grouped by the component and each group is applied to its pool at once,
+        //   with the pool memory reserved up front. Commands of the same component keep the order they were recorded in.
+        // - Entities are destroyed last. Components assigned to an entity destroyed by the same buffer are destroyed with it,
+        //   so the result is the same as when the commands were applied in the recorded order.
+        void Playback(Scene& scene)
+        {
+            mResolved.resize(mCreatedCount);
+            for (uint32_t i = 0; i < mCreatedCount; i++)
+                mResolved[i] = scene.NewEntity();
+
+            mSorted.clear();
+            for (auto&& cmd : mCommands)
+            {
+                cmd.entity = resolve(cmd.entity);
+                if (cmd.type == command_type::Assign || cmd.type == command_type::Remove)
+                    mSorted.push_back(cmd);
+            }
+            std::stable_sort(mSorted.begin(), mSorted.end(), [](const command& a, const command& b) { return a.component < b.component; });
+            for (size_t begin = 0; begin < mSorted.size(); )
+            {
+                size_t end = begin + 1;
+                while (end < mSorted.size() && mSorted[end].component == mSorted[begin].component)
+                    end++;
+                mSorted[begin].apply(scene, mSorted.data() + begin, end - begin);
+                begin = end;
+            }
+
+            for (auto&& cmd : mCommands)
+            {
+                if (cmd.type == command_type::DestroyEntity)
+                    scene.DestroyEntity(cmd.entity);
+                // Payload was consumed by the apply function.
+                cmd.destroy = nullptr;
+            }
+            Clear();
+        }
+        // Drop all recorded commands. Memory of the buffer is kept for future recording.
+        void Clear()
+        {
+            for (auto&& cmd : mCommands)
+                if (cmd.destroy)
+                    cmd.destroy(cmd.payload);
+            mCommands.clear();
+            mCreatedCount = 0;
+            mCurrentBlock = 0;
+            mBlockOffset = 0;
+        }
+
+    private:
+        // Entity indices of placeholders have this bit set.
+        static constexpr EntityIndex PLACEHOLDER_BIT = EntityIndex(1) << 31;
+        // Size of single block of payload memory.
+        static constexpr size_t PAYLOAD_BLOCK_SIZE = 16 * 1024;
+
+        enum class command_type : uint8_t { NewEntity, DestroyEntity, Assign, Remove };
+        struct command {
+            command_type type;
+            EntityID entity;
+            // Component of Assign and Remove commands.
+            int component = -1;
+            // Type-erased applyRun() of the component.
+            void (*apply)(Scene& scene, command* p_commands, size_t count) = nullptr;
+            // Destroy payload, which was not applied.
+            void (*destroy)(void* payload) = nullptr;
+            void* payload = nullptr;
+        };
+        std::vector<command> mCommands;
+        // Assign and Remove commands grouped by the component during the playback.
+        std::vector<command> mSorted;
+        uint32_t mCreatedCount{ 0 };
+        // Real IDs of the placeholders, filled during the playback.
+        std::vector<EntityID> mResolved;
+
+        // Payloads are stored in blocks, which are never reallocated, so the stored components never move.
+        struct payload_block {
+            std::unique_ptr<std::max_align_t[]> data;
+            size_t size;
+        };
+        std::vector<payload_block> mBlocks;
+        size_t mCurrentBlock{ 0 };
+        size_t mBlockOffset{ 0 };
+
+        // Apply run of Assign and Remove commands of the component, in their order. Payloads are moved into the pool.
+        template<typename TComponent>
+        static void applyRun(Scene& scene, command* p_commands, size_t count)
+        {
+            scene.Reserve<TComponent>(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                command& cmd = p_commands[i];
+                if (cmd.type == command_type::Remove)
+                {
+                    scene.Remove<TComponent>(cmd.entity);
+                    continue;
+                }
+                TComponent* p_component = scene.Assign<TComponent>(cmd.entity);
+                if constexpr (!std::is_empty_v<TComponent>)
+                {
+                    TComponent* p_payload = static_cast<TComponent*>(cmd.payload);
+                    if (p_component)
+                        *p_component = std::move(*p_payload);
+                    p_payload->~TComponent();
+                }
+            }
+        }
+        inline EntityID resolve(EntityID id) const
+        {
+            EntityIndex index = Utils::GetEntityIndex(id);
+            if (!Utils::IsEntityValid(id) || !(index & PLACEHOLDER_BIT))
+                return id;
+            return mResolved[index & ~PLACEHOLDER_BIT];
+        }
+        void* allocatePayload(size_t size, size_t alignment)
+        {
+            while (true)
+            {
+                if (mCurrentBlock == mBlocks.size())
+                {
+                    size_t block_size = std::max(size, PAYLOAD_BLOCK_SIZE);
+                    mBlocks.push_back({ std::unique_ptr<std::max_align_t[]>(new std::max_align_t[(block_size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t)]), block_size });
+                }
+
+                size_t offset = (mBlockOffset + alignment - 1) / alignment * alignment;
+                if (offset + size <= mBlocks[mCurrentBlock].size)
+                {
+                    mBlockOffset = offset + size;
+                    return reinterpret_cast<uint8_t*>(mBlocks[mCurrentBlock].data.get()) + offset;
+                }
+                mCurrentBlock++;
+                mBlockOffset = 0;
+            }
+        }
+    };
+}
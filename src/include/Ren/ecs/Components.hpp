@@ -5,7 +5,10 @@
 #include <Ren/InputInterface.hpp>
 #include <vector>             // std::vector
 #include <unordered_map>
+#include <cmath>              // std::sin, std::cos, std::atan2
 #include "SceneView.hpp"    // Scene, SceneView
+#include "CommandBuffer.hpp"    // EntityCommandBuffer
+#include "SpatialIndex.hpp"
 
 
 /*
@@ -25,13 +28,30 @@ namespace Ren::ecs
     protected:
         Scene* mpActiveScene{ nullptr };
         EntityID mEntityID = INVALID_ENTITY;
+        PerThread<EntityCommandBuffer>* mpCommandBuffers{ nullptr };
+        const SpatialIndex* mpSpatialIndex{ nullptr };
 
         template<typename TComponent>
-        inline TComponent* get()
+        inline const TComponent* get()
         {
             REN_ASSERT(mEntityID != INVALID_ENTITY && mpActiveScene, "Entity ID is invalid or no scene is associated.");
             return mpActiveScene->Get<TComponent>(mEntityID);
-        }      
+        }
+        // Same as get(), but the component can be modified and it is marked as changed.
+        template<typename TComponent>
+        inline TComponent* getMut()
+        {
+            REN_ASSERT(mEntityID != INVALID_ENTITY && mpActiveScene, "Entity ID is invalid or no scene is associated.");
+            return mpActiveScene->GetMut<TComponent>(mEntityID);
+        }
+        // Command buffer of the current thread. Use it for changing the scene structure from within the script.
+        inline EntityCommandBuffer& commands()
+        {
+            REN_ASSERT(mpCommandBuffers, "Script is not managed by SystemsManager.");
+            return mpCommandBuffers->Local();
+        }
+        // Spatial index of the scene's entities or nullptr, if it was not set by ScriptSystem::SetSpatialIndex().
+        inline const SpatialIndex* spatialIndex() const { return mpSpatialIndex; }
 
         friend class ScriptSystem;
     };
@@ -60,4 +80,52 @@ namespace Ren::ecs::components
 
         inline void Add(ScriptBehavior* script) { scripts.push_back(script); }
     };
+
+    // Parent of the entity in the transform hierarchy. Transform2D of the entity is then relative to the parent.
+    // - Use TransformSystem::SetParent() to change it, so that the Children of both parents stay consistent.
+    struct Parent
+    {
+        EntityID entity = INVALID_ENTITY;
+    };
+
+    struct Children
+    {
+        std::vector<EntityID> entities;
+    };
+
+    // World space transformation of entity in the transform hierarchy. Is computed by the TransformSystem.
+    // - Stored as 2x3 affine matrix, that maps entity's local space (origin at Transform2D::position, rotated around the center) to world space.
+    // - Only position and rotation are inherited. Scale is size of the entity and doesn't affect its children.
+    struct WorldTransform2D
+    {
+        glm::mat3x2 matrix{ 1.0f };
+        // Number of ancestors of the entity.
+        uint32_t depth{ 0 };
+
+        // Transform point from entity's local space to world space.
+        inline glm::vec2 Apply(glm::vec2 point) const { return matrix * glm::vec3(point, 1.0f); }
+        // Rotation in degrees, same as Transform2D::rotation.
+        inline float GetRotation() const { return -glm::degrees(std::atan2(matrix[0].y, matrix[0].x)); }
+        // Position which, together with GetRotation(), places quad of given size the same way as Renderer2D::Transform.
+        inline glm::vec2 GetPosition(glm::vec2 scale) const
+        {
+            glm::vec2 half_size = 0.5f * scale;
+            return matrix[2] + glm::mat2(matrix[0], matrix[1]) * half_size - half_size;
+        }
+
+        // Compute local transformation matrix of Transform2D.
+        static glm::mat3x2 FromLocal(const Transform2D& trans)
+        {
+            float angle = glm::radians(-trans.rotation);
+            glm::mat2 rot(std::cos(angle), std::sin(angle), -std::sin(angle), std::cos(angle));
+            glm::vec2 half_size = 0.5f * trans.scale;
+            return glm::mat3x2(rot[0], rot[1], trans.position + half_size - rot * half_size);
+        }
+        // Compose parent's world matrix with child's local matrix.
+        static glm::mat3x2 Combine(const glm::mat3x2& parent, const glm::mat3x2& local)
+        {
+            glm::mat2 parent_rot(parent[0], parent[1]);
+            return glm::mat3x2(parent_rot * local[0], parent_rot * local[1], parent_rot * local[2] + parent[2]);
+        }
+    };
 };
\ No newline at end of file
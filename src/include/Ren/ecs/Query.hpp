@@ -0,0 +1,175 @@
+#pragma once
+#include "Scene.hpp"
+#include "SceneView.hpp"    // PARALLEL_CHUNK_ALIGN
+#include "Ren/ThreadPool.hpp"
+#include <tuple>        // std::tuple, std::get
+#include <atomic>       // std::atomic
+#include <algorithm>    // std::min, std::max
+
+namespace Ren::ecs
+{
+    // Filters used as parameters of Scene::Query().
+    // - With<>: entity must have all of the components. They are passed to each() as const references.
+    // - Without<>: entity must have none of the components. They are not passed to each().
+    // - Optional<>: entity may have the components. They are passed to each() as const pointers (nullptr if missing).
+    // Components in With<> and Optional<> can be wrapped in Mut<> to get mutable access (see Mut<> in SceneView.hpp).
+    template<typename... TComponents> struct With {};
+    template<typename... TComponents> struct Without {};
+    template<typename... TComponents> struct Optional {};
+
+    namespace Utils
+    {
+        template<typename... T> struct TypeList {};
+
+        template<typename... TLists> struct ConcatTypeLists { using Type = TypeList<>; };
+        template<typename... A> struct ConcatTypeLists<TypeList<A...>> { using Type = TypeList<A...>; };
+        template<typename... A, typename... B, typename... TRest> struct ConcatTypeLists<TypeList<A...>, TypeList<B...>, TRest...>
+        {
+            using Type = typename ConcatTypeLists<TypeList<A..., B...>, TRest...>::Type;
+        };
+
+        // Split single query filter into lists of With, Without and Optional components.
+        template<typename T> struct QueryFilterTraits { static_assert(sizeof(T) == 0, "Query accepts only With<>, Without<> and Optional<> filters."); };
+        template<typename... T> struct QueryFilterTraits<With<T...>> { using With = TypeList<T...>; using Without = TypeList<>; using Optional = TypeList<>; };
+        template<typename... T> struct QueryFilterTraits<Without<T...>> { using With = TypeList<>; using Without = TypeList<T...>; using Optional = TypeList<>; };
+        template<typename... T> struct QueryFilterTraits<Optional<T...>> { using With = TypeList<>; using Without = TypeList<>; using Optional = TypeList<T...>; };
+
+        // Lists of all With, Without and Optional components of the query.
+        template<typename... TFilters> struct QueryTraits
+        {
+            using With = typename ConcatTypeLists<TypeList<>, typename QueryFilterTraits<TFilters>::With...>::Type;
+            using Without = typename ConcatTypeLists<TypeList<>, typename QueryFilterTraits<TFilters>::Without...>::Type;
+            using Optional = typename ConcatTypeLists<TypeList<>, typename QueryFilterTraits<TFilters>::Optional...>::Type;
+        };
+
+        template<typename... T>
+        inline ComponentMask CreateMask(TypeList<T...>)
+        {
+            ComponentMask mask;
+            (mask.set(GetId<ViewComponent<T>>()), ...);
+            return mask;
+        }
+    }
+
+    // Handle of a query registered in the scene (see Scene::Query()). It is cheap to create, so it can be obtained every frame.
+    // - Entities and components must not be added or removed during the iteration.
+    template<typename... TFilters>
+    class CachedQuery
+    {
+        using Traits = Utils::QueryTraits<TFilters...>;
+    public:
+        CachedQuery(Scene* scene, QueryCache* cache)
+            : mpScene(scene)
+            , mpCache(cache) {}
+
+        // Number of matching entities.
+        inline size_t Size() const { return mpCache->members.size(); }
+        inline bool Contains(EntityIndex index) const { return mpCache->members.contains(index); }
+
+        // Start recording entities, which leave the query (are destroyed or stop matching). See ConsumeRemoved().
+        // Recording is shared by all handles of the same query.
+        inline void TrackRemoved() { mpCache->track_removed = true; }
+        // Call func(EntityIndex) for every entity, which left the query since the last call, and clear the record.
+        // Entity at the index may match the query again (or the index may be reused), which can be checked by Contains().
+        template<typename TFunc>
+        void ConsumeRemoved(TFunc&& func)
+        {
+            for (auto&& index : mpCache->removed)
+                func(index);
+            mpCache->removed.clear();
+        }
+
+        struct Iterator
+        {
+            const EntityIndex* pIndex;
+            Scene* pScene;
+
+            inline EntityID operator*() const { return pScene->mEntities[*pIndex].id; }
+            inline Iterator& operator++() { ++pIndex; return *this; }
+            inline bool operator!=(const Iterator& rhs) const { return pIndex != rhs.pIndex; }
+        };
+        inline Iterator begin() const { return { mpCache->members.entities(), mpScene }; }
+        inline Iterator end() const { return { mpCache->members.entities() + Size(), mpScene }; }
+
+        // Call func(EntityID, const With&..., const Optional*...) for every matching entity. Mut<> components are passed
+        // as mutable and marked as changed.
+        template<typename TFunc>
+        void each(TFunc&& func)
+        {
+            eachRange(func, 0, uint32_t(Size()), typename Traits::With{}, typename Traits::Optional{});
+        }
+        // Same as each(), but the entities are split into chunks, which are processed in parallel on the thread pool.
+        // See SceneView::ParallelEach() for the details.
+        template<typename TFunc>
+        void ParallelEach(TFunc&& func, uint32_t chunk_size = 0, ThreadPool& pool = ThreadPool::Get())
+        {
+            uint32_t count = uint32_t(Size());
+            if (chunk_size == 0)
+                chunk_size = count / (pool.GetThreadCount() * 4);
+            chunk_size = std::max(PARALLEL_CHUNK_ALIGN, (chunk_size + PARALLEL_CHUNK_ALIGN - 1) / PARALLEL_CHUNK_ALIGN * PARALLEL_CHUNK_ALIGN);
+            uint32_t chunk_count = (count + chunk_size - 1) / chunk_size;
+
+            if (chunk_count <= 1 || pool.GetWorkerCount() == 0)
+            {
+                each(func);
+                return;
+            }
+
+            std::atomic<uint32_t> remaining{ chunk_count };
+            for (uint32_t chunk = 0; chunk < chunk_count; chunk++)
+                pool.Submit([&, chunk] {
+                    eachRange(func, chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size), typename Traits::With{}, typename Traits::Optional{});
+                    remaining--;
+                });
+            pool.WaitUntil([&remaining] { return remaining == 0; });
+        }
+
+    private:
+        Scene* mpScene;
+        QueryCache* mpCache;
+
+        // Pool of a component, which every matching entity has.
+        template<typename T>
+        struct required_pool {
+            static_assert(Utils::ViewTraits<T>::Filter == Utils::ViewFilter::None, "Query doesn't support Added<> and Changed<> filters.");
+            ComponentPool* pool;
+            inline Utils::ViewRef<T> get(EntityIndex index, ChangeTick tick) const { return Utils::ViewAt<T>(pool, pool->dense_index(index), tick); }
+        };
+        // Pool of an optional component. Pool doesn't have to exist.
+        template<typename T>
+        struct optional_pool {
+            static_assert(Utils::ViewTraits<T>::Filter == Utils::ViewFilter::None, "Query doesn't support Added<> and Changed<> filters.");
+            ComponentPool* pool;
+            inline Utils::ViewPtr<T> get(EntityIndex index, ChangeTick tick) const
+            {
+                uint32_t dense_i = pool ? pool->dense_index(index) : ComponentPool::INVALID_DENSE;
+                return dense_i == ComponentPool::INVALID_DENSE ? nullptr : &Utils::ViewAt<T>(pool, dense_i, tick);
+            }
+        };
+
+        // Call func for matching entities at positions [begin, end) of the query's entity list.
+        template<typename TFunc, typename... TWith, typename... TOptional>
+        void eachRange(TFunc& func, uint32_t begin, uint32_t end, Utils::TypeList<TWith...>, Utils::TypeList<TOptional...>)
+        {
+            // Pools are looked up for every call, because Scene::Compact() can delete them.
+            std::tuple<required_pool<TWith>...> with_pools{ required_pool<TWith>{ mpScene->getPool<Utils::ViewComponent<TWith>>() }... };
+            std::tuple<optional_pool<TOptional>...> optional_pools{ optional_pool<TOptional>{ mpScene->getPool<Utils::ViewComponent<TOptional>>() }... };
+
+            const EntityIndex* entities = mpCache->members.entities();
+            ChangeTick tick = mpScene->GetTick();
+            for (uint32_t i = begin; i < end; i++)
+            {
+                EntityIndex index = entities[i];
+                func(mpScene->mEntities[index].id, std::get<required_pool<TWith>>(with_pools).get(index, tick)..., std::get<optional_pool<TOptional>>(optional_pools).get(index, tick)...);
+            }
+        }
+    };
+
+    template<typename... TFilters>
+    CachedQuery<TFilters...> Scene::Query()
+    {
+        using Traits = Utils::QueryTraits<TFilters...>;
+        QueryCache* cache = getQuery(Utils::CreateMask(typename Traits::With{}), Utils::CreateMask(typename Traits::Without{}));
+        return CachedQuery<TFilters...>(this, cache);
+    }
+}
@@ -3,6 +3,14 @@
 #include <vector>   // std::vector
 #include <bitset>   // std::bitset
 #include <tuple>    // std::tuple, std::make_tuple
+#include <algorithm>    // std::fill_n, std::min, std::count_if
+#include <cstring>      // std::memcpy
+#include <type_traits>  // std::is_empty_v, std::is_trivially_destructible_v
+#include <utility>      // std::move
+#include <new>          // placement new
+#include <atomic>       // std::atomic
+#include <array>        // std::array
+#include <memory>       // std::unique_ptr
 #include "Ren/Core.h"   // Ref
 
 namespace Ren::ecs
@@ -10,6 +18,8 @@ namespace Ren::ecs
     typedef uint64_t EntityID;
     typedef uint32_t EntityIndex;
     typedef uint32_t EntityVersion;
+    // Scene tick, at which component was added or last changed.
+    typedef uint32_t ChangeTick;
     const int MAX_COMPONENTS = 32;
     typedef std::bitset<MAX_COMPONENTS> ComponentMask;
 
@@ -23,7 +33,7 @@ namespace Ren::ecs
         // Return unique ID for each type. We don't need to know these types
         // as those will be defined by the user. Thus all this function does
         // is assigning new unique IDs to different types.
-        int component_count = 0;
+        inline std::atomic<int> component_count{ 0 };
         template<typename T>
         int GetId()
         {
@@ -33,28 +43,313 @@ namespace Ren::ecs
     }
     #define INVALID_ENTITY Utils::CreateEntityID(EntityIndex(-1), 0)
 
-    // Component pool, which will hold data for each entity.
-    // For now, each component pool will allocate MAX_COMPONENTS worth of memory for each component type.
-    // - TODO: It would be more efficient to use other means of storing them. For small games, this should be fine though.
-    // - !! WARNING !! Component pool allocates memory when constructed and deletes it when destructed. Thus it is recommended to keep it in heap memory. Use with care!
+    // Number of elements in single page of the component pool (both sparse index and component storage are paged).
+    const size_t POOL_PAGE_SIZE = 4096;
+
+    // Component pool, which holds components of one type, stored as a paged sparse set.
+    // - Dense arrays (components and their entities) are kept packed, so iterating them touches only live components.
+    // - Sparse index maps entity index to position in dense arrays. It is split into pages, which are allocated
+    //   only for the ranges of entity indices that actually have the component.
+    // - Component storage is paged as well, so growing the pool never moves already existing components
+    //   (pointers returned by Scene::Assign stay valid until the component is removed).
+    // - Empty (tag) components are not stored at all. Only the entity is registered in the pool.
+    // - Pool destroys its components when they are erased or when the pool is deleted. Unused component pages are freed
+    //   automatically (one spare page is kept), empty sparse pages are freed by shrink().
+    // - !! WARNING !! Pool does not construct components, it only provides the memory. Construction is done by the Scene.
     struct ComponentPool
     {
-        // Size of component, which will be stored in this pool.
+        // Move component from src to uninitialized dst and destroy the src.
+        typedef void (*RelocateFn)(void* dst, void* src);
+        // Call destructor of the component.
+        typedef void (*DestroyFn)(void* component);
+        // Value of the sparse index for entities, which are not in the pool.
+        static constexpr uint32_t INVALID_DENSE = uint32_t(-1);
+
+        // Size of component, which will be stored in this pool. Is 0 for tag components.
         size_t element_size{ 0 };
-        // Array of bytes to store any type. Using this type allows for easier pointer arithmetic.
-        uint8_t* p_data{ nullptr };
+        RelocateFn relocate{ nullptr };
+        // Is nullptr for trivially destructible components.
+        DestroyFn destroy{ nullptr };
+
+        ComponentPool(size_t element_size, RelocateFn relocate, DestroyFn destroy)
+            : element_size(element_size)
+            , relocate(relocate)
+            , destroy(destroy) {}
+        ComponentPool(const ComponentPool&) = delete;
+        ComponentPool& operator=(const ComponentPool&) = delete;
+        ~ComponentPool()
+        {
+            if (destroy)
+                for (size_t i = 0; i < size(); i++)
+                    destroy(at(i));
+            for (auto&& page : mDataPages)
+                ::operator delete(page);
+            for (auto&& page : mSparsePages)
+                delete[] page;
+        }
 
-        ComponentPool(size_t element_size)
+        // Create pool for given component type.
+        template<typename TComponent>
+        static ComponentPool* Create()
         {
-            this->element_size = element_size;
-            p_data = new uint8_t[element_size * MAX_COMPONENTS];
+            if constexpr (std::is_empty_v<TComponent>)
+                return new ComponentPool(0, nullptr, nullptr);
+            else
+            {
+                DestroyFn destroy = nullptr;
+                if constexpr (!std::is_trivially_destructible_v<TComponent>)
+                    destroy = [](void* component) { static_cast<TComponent*>(component)->~TComponent(); };
+
+                return new ComponentPool(sizeof(TComponent), [](void* dst, void* src) {
+                    TComponent* p_src = static_cast<TComponent*>(src);
+                    new(dst) TComponent(std::move(*p_src));
+                    p_src->~TComponent();
+                }, destroy);
+            }
         }
-        ~ComponentPool() { delete[] p_data; }
 
-        // Return component at given index.
-        inline void* get(size_t index) { return p_data + index * element_size; }
+        // Number of live components in the pool.
+        inline size_t size() const { return mDenseEntities.size(); }
+        // Number of components, which fit into already allocated pages.
+        inline size_t capacity() const { return is_tag() ? mDenseEntities.capacity() : mDataPages.size() * POOL_PAGE_SIZE; }
+        inline bool is_tag() const { return element_size == 0; }
+        // Dense array of entity indices. Entity at position i owns component at(i).
+        inline const EntityIndex* entities() const { return mDenseEntities.data(); }
+        // Return component at given position in the dense array.
+        inline void* at(size_t dense_i)
+        {
+            if (is_tag())
+                return &mTagInstance;
+            return mDataPages[dense_i / POOL_PAGE_SIZE] + (dense_i % POOL_PAGE_SIZE) * element_size;
+        }
+        // Ticks at which the component at given position in the dense array was added and last changed.
+        inline ChangeTick added_tick(size_t dense_i) const { return mAddedTicks[dense_i]; }
+        inline ChangeTick changed_tick(size_t dense_i) const { return mChangedTicks[dense_i]; }
+        inline void set_changed(size_t dense_i, ChangeTick tick) { mChangedTicks[dense_i] = tick; }
+        // Return position of entity's component in the dense array or INVALID_DENSE.
+        inline uint32_t dense_index(EntityIndex index) const
+        {
+            size_t page = index / POOL_PAGE_SIZE;
+            if (page >= mSparsePages.size() || mSparsePages[page] == nullptr)
+                return INVALID_DENSE;
+            return mSparsePages[page][index % POOL_PAGE_SIZE];
+        }
+        inline bool contains(EntityIndex index) const { return dense_index(index) != INVALID_DENSE; }
+        // Return component of given entity. Entity must have the component.
+        inline void* get(EntityIndex index) { return at(dense_index(index)); }
+        // Bytes allocated by the pool (component pages, sparse pages and dense arrays).
+        size_t memory_usage() const
+        {
+            size_t sparse_pages = std::count_if(mSparsePages.begin(), mSparsePages.end(), [](const uint32_t* page) { return page != nullptr; });
+            return mDataPages.size() * POOL_PAGE_SIZE * element_size
+                + sparse_pages * POOL_PAGE_SIZE * sizeof(uint32_t)
+                + mSparsePages.capacity() * sizeof(uint32_t*) + mSparseCounts.capacity() * sizeof(uint32_t)
+                + mDenseEntities.capacity() * sizeof(EntityIndex)
+                + (mAddedTicks.capacity() + mChangedTicks.capacity()) * sizeof(ChangeTick);
+        }
+
+        // Register entity in the pool and return memory for its component.
+        // If the entity is already registered, then its current component is destroyed, its memory returned and it is marked as changed.
+        void* insert(EntityIndex index, ChangeTick tick)
+        {
+            uint32_t dense_i = dense_index(index);
+            if (dense_i != INVALID_DENSE)
+            {
+                if (destroy)
+                    destroy(at(dense_i));
+                set_changed(dense_i, tick);
+                return at(dense_i);
+            }
+
+            dense_i = uint32_t(mDenseEntities.size());
+            if (!is_tag() && dense_i / POOL_PAGE_SIZE >= mDataPages.size())
+                mDataPages.push_back(static_cast<uint8_t*>(::operator new(POOL_PAGE_SIZE * element_size)));
+            mDenseEntities.push_back(index);
+            mAddedTicks.push_back(tick);
+            mChangedTicks.push_back(tick);
+            set_sparse(index, dense_i);
+            return at(dense_i);
+        }
+        // Allocate dense arrays and component pages for count more components, so that following inserts don't reallocate.
+        void reserve(size_t count)
+        {
+            size_t total = size() + count;
+            if (total > mDenseEntities.capacity())
+            {
+                // Keep the geometric growth, as this is called with small counts too.
+                size_t new_capacity = std::max(total, 2 * mDenseEntities.capacity());
+                mDenseEntities.reserve(new_capacity);
+                mAddedTicks.reserve(new_capacity);
+                mChangedTicks.reserve(new_capacity);
+            }
+            if (!is_tag())
+                while (mDataPages.size() * POOL_PAGE_SIZE < total)
+                    mDataPages.push_back(static_cast<uint8_t*>(::operator new(POOL_PAGE_SIZE * element_size)));
+        }
+        // Register entities, which are not in the pool yet, and copy their components from data bytewise.
+        // Components are copied page by page, so it should only be used for trivially copyable components. data is ignored for tags.
+        void insert_bulk(const EntityIndex* indices, size_t count, const void* data, ChangeTick tick)
+        {
+            size_t first = mDenseEntities.size();
+            mDenseEntities.insert(mDenseEntities.end(), indices, indices + count);
+            mAddedTicks.resize(first + count, tick);
+            mChangedTicks.resize(first + count, tick);
+            for (size_t i = 0; i < count; i++)
+                set_sparse(indices[i], uint32_t(first + i));
+
+            if (is_tag())
+                return;
+            const uint8_t* p_src = static_cast<const uint8_t*>(data);
+            for (size_t dense_i = first; dense_i < first + count; )
+            {
+                if (dense_i / POOL_PAGE_SIZE >= mDataPages.size())
+                    mDataPages.push_back(static_cast<uint8_t*>(::operator new(POOL_PAGE_SIZE * element_size)));
+                size_t n = std::min(POOL_PAGE_SIZE - dense_i % POOL_PAGE_SIZE, first + count - dense_i);
+                std::memcpy(at(dense_i), p_src, n * element_size);
+                p_src += n * element_size;
+                dense_i += n;
+            }
+        }
+        // Remove entity from the pool and destroy its component. Last component is moved to the freed position, to keep the dense arrays packed.
+        void erase(EntityIndex index)
+        {
+            uint32_t dense_i = dense_index(index);
+            if (dense_i == INVALID_DENSE)
+                return;
+
+            if (destroy)
+                destroy(at(dense_i));
+            uint32_t last_i = uint32_t(mDenseEntities.size() - 1);
+            if (dense_i != last_i)
+            {
+                EntityIndex last_entity = mDenseEntities[last_i];
+                if (!is_tag())
+                    relocate(at(dense_i), at(last_i));
+                mDenseEntities[dense_i] = last_entity;
+                mAddedTicks[dense_i] = mAddedTicks[last_i];
+                mChangedTicks[dense_i] = mChangedTicks[last_i];
+                mSparsePages[last_entity / POOL_PAGE_SIZE][last_entity % POOL_PAGE_SIZE] = dense_i;
+            }
+            mDenseEntities.pop_back();
+            mAddedTicks.pop_back();
+            mChangedTicks.pop_back();
+            set_sparse(index, INVALID_DENSE);
+
+            // Free trailing component pages, but keep one spare to avoid reallocating when the pool oscillates around the page boundary.
+            size_t used_pages = (size() + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE;
+            while (mDataPages.size() > used_pages + 1)
+            {
+                ::operator delete(mDataPages.back());
+                mDataPages.pop_back();
+            }
+        }
+        // Free all unused pages and shrink the dense arrays to fit the live components.
+        void shrink()
+        {
+            size_t used_pages = (size() + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE;
+            while (mDataPages.size() > used_pages)
+            {
+                ::operator delete(mDataPages.back());
+                mDataPages.pop_back();
+            }
+            for (size_t page = 0; page < mSparsePages.size(); page++)
+                if (mSparsePages[page] && mSparseCounts[page] == 0)
+                {
+                    delete[] mSparsePages[page];
+                    mSparsePages[page] = nullptr;
+                }
+            while (!mSparsePages.empty() && mSparsePages.back() == nullptr)
+            {
+                mSparsePages.pop_back();
+                mSparseCounts.pop_back();
+            }
+            mSparsePages.shrink_to_fit();
+            mSparseCounts.shrink_to_fit();
+            mDataPages.shrink_to_fit();
+            mDenseEntities.shrink_to_fit();
+            mAddedTicks.shrink_to_fit();
+            mChangedTicks.shrink_to_fit();
+        }
+
+    private:
+        std::vector<EntityIndex> mDenseEntities;
+        std::vector<ChangeTick> mAddedTicks;
+        std::vector<ChangeTick> mChangedTicks;
+        std::vector<uint8_t*> mDataPages;
+        std::vector<uint32_t*> mSparsePages;
+        // Number of entities registered in each sparse page.
+        std::vector<uint32_t> mSparseCounts;
+        // Tag components have no state, so all entities share this one.
+        uint8_t mTagInstance{ 0 };
+
+        // Set sparse index entry of given entity. Allocates the sparse page if it doesn't exist.
+        void set_sparse(EntityIndex index, uint32_t dense_i)
+        {
+            size_t page = index / POOL_PAGE_SIZE;
+            if (page >= mSparsePages.size())
+            {
+                mSparsePages.resize(page + 1, nullptr);
+                mSparseCounts.resize(page + 1, 0);
+            }
+            if (mSparsePages[page] == nullptr)
+            {
+                mSparsePages[page] = new uint32_t[POOL_PAGE_SIZE];
+                std::fill_n(mSparsePages[page], POOL_PAGE_SIZE, INVALID_DENSE);
+            }
+
+            uint32_t& entry = mSparsePages[page][index % POOL_PAGE_SIZE];
+            if (entry == INVALID_DENSE && dense_i != INVALID_DENSE)
+                mSparseCounts[page]++;
+            else if (entry != INVALID_DENSE && dense_i == INVALID_DENSE)
+                mSparseCounts[page]--;
+            entry = dense_i;
+        }
+    };
+
+    // Set of entities matching one registered query (see Scene::Query()).
+    // - Membership is kept up to date by the Scene whenever components are assigned or removed,
+    //   so the query never has to scan the entity table.
+    // - Entities are stored in a tag pool, which is a sparse set with the same paging as the component pools.
+    struct QueryCache
+    {
+        // Entity must have all of these components.
+        ComponentMask with;
+        // Entity must have none of these components.
+        ComponentMask without;
+        ComponentPool members{ 0, nullptr, nullptr };
+        // Indices of entities, which left the query (see CachedQuery::TrackRemoved()). Recorded only when track_removed is set.
+        std::vector<EntityIndex> removed;
+        bool track_removed{ false };
+
+        QueryCache(ComponentMask with, ComponentMask without)
+            : with(with)
+            , without(without) {}
+
+        inline bool matches(const ComponentMask& mask) const { return (mask & with) == with && (mask & without).none(); }
+        // Add or remove the entity based on its current component mask.
+        inline void update(EntityIndex index, const ComponentMask& mask, ChangeTick tick)
+        {
+            bool match = matches(mask);
+            if (match != members.contains(index))
+            {
+                if (match)
+                    members.insert(index, tick);
+                else
+                    erase(index);
+            }
+        }
+        inline void erase(EntityIndex index)
+        {
+            if (!members.contains(index))
+                return;
+            members.erase(index);
+            if (track_removed)
+                removed.push_back(index);
+        }
     };
 
+    template<typename... TFilters> class CachedQuery;
+
     // Scene object, that stores all entities and manages assigning components to them.
     class Scene
     {
@@ -87,26 +382,37 @@ namespace Ren::ecs
             mEntities.push_back({ Utils::CreateEntityID(EntityIndex(mEntities.size()), 0), ComponentMask() });
             return mEntities.back().id;
         }
+        // Check if the entity exists. IDs of destroyed entities and INVALID_ENTITY are not alive.
+        inline bool IsAlive(EntityID id) const
+        {
+            return Utils::GetEntityIndex(id) < mEntities.size() && mEntities[Utils::GetEntityIndex(id)].id == id;
+        }
         // Assign component to given entity. Returns pointer to the newly created component instance.
         template<typename TComponent>
         TComponent* Assign(EntityID id)
         {
             // Ensure we are not accessing entity that has been deleted.
-            if (mEntities[Utils::GetEntityIndex(id)].id != id)
+            if (!IsAlive(id))
                 return nullptr;
 
             int component_id = Utils::GetId<TComponent>();
+            createPool<TComponent>();
 
-            if ((int)mComponentPools.size() <= component_id)
-                mComponentPools.resize(mComponentPools.size() + 1, nullptr);
-            if (mComponentPools[component_id] == nullptr)
-                mComponentPools[component_id] = new ComponentPool(sizeof(TComponent));
-
-            // Create component in already allocated memory in component pool by using a **placement new**.
-            TComponent* p_component = new(mComponentPools[component_id]->get(Utils::GetEntityIndex(id))) TComponent();
+            // Create component in memory provided by the component pool by using a **placement new**.
+            // If the entity already had the component, the pool destroyed the old instance first.
+            // Tag components are not stored, so there is nothing to construct.
+            void* p_memory = mComponentPools[component_id]->insert(Utils::GetEntityIndex(id), mTick);
+            TComponent* p_component = static_cast<TComponent*>(p_memory);
+            if constexpr (!std::is_empty_v<TComponent>)
+                p_component = new(p_memory) TComponent();
 
             // Set bit corresponding to this component ID, to indicate that it is in use.
-            mEntities[Utils::GetEntityIndex(id)].mask.set(component_id);
+            ComponentMask& mask = mEntities[Utils::GetEntityIndex(id)].mask;
+            if (!mask.test(component_id))
+            {
+                mask.set(component_id);
+                notifyQueries(Utils::GetEntityIndex(id), component_id);
+            }
             return p_component;
         }
         // Assign multiple components to given entity. Returns tuple of pointers to the newly created components.
@@ -115,58 +421,221 @@ namespace Ren::ecs
         {
             return std::make_tuple(Assign<TComponents>(id)...);
         }
-        // Explicitly get pointer to the component instance for given entity. If component instance doesn't exist, nullptr is returned.
+        // Explicitly get read-only pointer to the component instance for given entity. If component instance doesn't exist, nullptr is returned.
+        // Use GetMut() for modifying the component, so that the change is visible to Changed<> filters.
         template<typename TComponent>
-        TComponent* Get(EntityID id)
+        const TComponent* Get(EntityID id)
         {
-            if (mEntities[Utils::GetEntityIndex(id)].id != id)
-                return nullptr;
-            
-            // Check if entity has given component.
-            int component_id = Utils::GetId<TComponent>();
-            if (!mEntities[Utils::GetEntityIndex(id)].mask.test(component_id))
-                return nullptr;
-            
-            return static_cast<TComponent*>(mComponentPools[component_id]->get(Utils::GetEntityIndex(id)));
+            return getComponent<TComponent>(id);
         }
         template<typename... TComponents>
-        std::tuple<TComponents*...> GetMultiple(EntityID id)
+        std::tuple<const TComponents*...> GetMultiple(EntityID id)
         {
             return std::make_tuple(Get<TComponents>(id)...);
         }
+        // Same as Get(), but the component can be modified and it is marked as changed in the current tick.
+        template<typename TComponent>
+        TComponent* GetMut(EntityID id)
+        {
+            TComponent* p_component = getComponent<TComponent>(id);
+            if (p_component)
+                MarkChanged<TComponent>(id);
+            return p_component;
+        }
+        // Mark entity's component as changed in the current tick.
+        template<typename TComponent>
+        void MarkChanged(EntityID id)
+        {
+            if (!IsAlive(id))
+                return;
+            int component_id = Utils::GetId<TComponent>();
+            if (!mEntities[Utils::GetEntityIndex(id)].mask.test(component_id))
+                return;
+
+            ComponentPool* pool = mComponentPools[component_id];
+            pool->set_changed(pool->dense_index(Utils::GetEntityIndex(id)), mTick);
+        }
+
+        // Current tick of the scene. Components added or changed are stamped with it.
+        inline ChangeTick GetTick() const { return mTick; }
+        // Start new tick. Is called by the SystemsManager after the update and after the rendering (see Added<> and Changed<> in SceneView.hpp).
+        inline void AdvanceTick() { mTick++; }
+        // Preallocate memory for count more components of the type, e.g. before assigning it to many entities.
+        template<typename TComponent>
+        void Reserve(size_t count)
+        {
+            createPool<TComponent>()->reserve(count);
+        }
         // Remove component from given entity.
         template<typename TComponent>
         void Remove(EntityID id)
         {
-            if (mEntities[Utils::GetEntityIndex(id)].id != id)
+            if (!IsAlive(id))
                 return;
             
-            // Just set the bit, which corresponds to component, to low.
             int component_id = Utils::GetId<TComponent>();
+            if (!mEntities[Utils::GetEntityIndex(id)].mask.test(component_id))
+                return;
+
+            mComponentPools[component_id]->erase(Utils::GetEntityIndex(id));
             mEntities[Utils::GetEntityIndex(id)].mask.reset(component_id);
+            notifyQueries(Utils::GetEntityIndex(id), component_id);
         }
-        // Destroy the entity and remove all of its components. Note that the components itself will not be deleted
-        // as they are stored in prealocated memory of the component pool.
-        // - TODO: In the future, we could keep track of active components in component pool and if needed, delete the pool.
+        // Destroy the entity and remove all of its components from their pools.
         void DestroyEntity(EntityID id)
         {
+            if (!IsAlive(id))
+                return;
+
+            // Remove the entity from all pools it is registered in.
+            const ComponentMask& mask = mEntities[Utils::GetEntityIndex(id)].mask;
+            for (size_t i = 0; i < mComponentPools.size(); i++)
+                if (mask.test(i))
+                    mComponentPools[i]->erase(Utils::GetEntityIndex(id));
+            for (auto&& query : mQueries)
+                query->erase(Utils::GetEntityIndex(id));
+
             // Invalidate this ID and increase the version.
             EntityID new_id = Utils::CreateEntityID(EntityIndex(-1), Utils::GetEntityVersion(id) + 1);
             mEntities[Utils::GetEntityIndex(id)].id = new_id;
-            // Remove (deassign) all components.
+            // Deassign all components.
             mEntities[Utils::GetEntityIndex(id)].mask.reset();
             // Register as free entity for future recyclation of the index.
             mFreeEntities.push_back(Utils::GetEntityIndex(id));
         }
 
+        // Get registered query of entities, which have all the With<> components and none of the Without<> components.
+        // Optional<> components are passed to the query's each() as pointers (nullptr if the entity doesn't have them).
+        // - Query is registered on the first call and then kept up to date incrementally, so iterating it
+        //   visits only the matching entities. Queries with the same With<> and Without<> components share their entity list.
+        // - Defined in Query.hpp.
+        // Example:
+        //     scene.Query<With<Mut<Transform2D>, SpriteRenderer>, Without<Hidden>, Optional<WorldTransform2D>>().each(
+        //         [](EntityID id, Transform2D& t, const SpriteRenderer& s, const WorldTransform2D* world) { ... });
+        template<typename... TFilters>
+        CachedQuery<TFilters...> Query();
+
+        // Memory statistics of one component pool.
+        struct PoolStats {
+            int component_id;
+            // Size of one component. Is 0 for tags.
+            size_t element_size;
+            // Number of components currently assigned.
+            size_t live_count;
+            // Number of components, which fit into already allocated memory.
+            size_t capacity;
+            // Bytes allocated by the pool.
+            size_t memory_bytes;
+        };
+        // Return statistics of all existing component pools.
+        std::vector<PoolStats> GetPoolStats() const
+        {
+            std::vector<PoolStats> stats;
+            for (size_t i = 0; i < mComponentPools.size(); i++)
+                if (mComponentPools[i])
+                    stats.push_back({ int(i), mComponentPools[i]->element_size, mComponentPools[i]->size(), mComponentPools[i]->capacity(), mComponentPools[i]->memory_usage() });
+            return stats;
+        }
+        // Release memory, which is not used by any live component.
+        // - Empty pools are deleted (they are created again on next Assign), other pools free their unused pages.
+        // - Should be called after destroying large number of entities, e.g. when unloading a level.
+        void Compact()
+        {
+            for (auto&& pool : mComponentPools)
+            {
+                if (pool && pool->size() == 0)
+                {
+                    delete pool;
+                    pool = nullptr;
+                }
+                else if (pool)
+                    pool->shrink();
+            }
+            while (!mComponentPools.empty() && mComponentPools.back() == nullptr)
+                mComponentPools.pop_back();
+            mComponentPools.shrink_to_fit();
+            mFreeEntities.shrink_to_fit();
+        }
+
     private:
         std::vector<EntityDesc>     mEntities;
         std::vector<ComponentPool*> mComponentPools;
         // Keep track of destroyed entities, so that we can use their indexes for new entities (thus not wasting memory).
         std::vector<EntityIndex>    mFreeEntities;
+        ChangeTick                  mTick{ 1 };
+        std::vector<std::unique_ptr<QueryCache>> mQueries;
+        // Queries, which depend on given component (have it in their With or Without mask).
+        std::array<std::vector<QueryCache*>, MAX_COMPONENTS> mQueriesByComponent;
 
         Scene() = default;
 
+        // Return component of given entity or nullptr, if the entity is not alive or doesn't have it.
+        template<typename TComponent>
+        TComponent* getComponent(EntityID id)
+        {
+            if (!IsAlive(id))
+                return nullptr;
+            
+            // Check if entity has given component.
+            int component_id = Utils::GetId<TComponent>();
+            if (!mEntities[Utils::GetEntityIndex(id)].mask.test(component_id))
+                return nullptr;
+            
+            return static_cast<TComponent*>(mComponentPools[component_id]->get(Utils::GetEntityIndex(id)));
+        }
+        // Return pool of given component type or nullptr, if no such component was assigned yet.
+        template<typename TComponent>
+        ComponentPool* getPool()
+        {
+            int component_id = Utils::GetId<TComponent>();
+            return component_id < (int)mComponentPools.size() ? mComponentPools[component_id] : nullptr;
+        }
+        // Return pool of given component type. Pool is created, if it doesn't exist yet.
+        template<typename TComponent>
+        ComponentPool* createPool()
+        {
+            int component_id = Utils::GetId<TComponent>();
+            if ((int)mComponentPools.size() <= component_id)
+                mComponentPools.resize(component_id + 1, nullptr);
+            if (mComponentPools[component_id] == nullptr)
+                mComponentPools[component_id] = ComponentPool::Create<TComponent>();
+            return mComponentPools[component_id];
+        }
+
+        // Update membership of the entity in queries, which depend on the changed component.
+        inline void notifyQueries(EntityIndex index, int component_id)
+        {
+            for (auto&& query : mQueriesByComponent[component_id])
+                query->update(index, mEntities[index].mask, mTick);
+        }
+        // Return query with given masks. If no such query exists, it is registered and filled with the matching entities.
+        QueryCache* getQuery(const ComponentMask& with, const ComponentMask& without)
+        {
+            for (auto&& query : mQueries)
+                if (query->with == with && query->without == without)
+                    return query.get();
+
+            mQueries.emplace_back(new QueryCache(with, without));
+            QueryCache* query = mQueries.back().get();
+            for (int i = 0; i < MAX_COMPONENTS; i++)
+                if (with.test(i) || without.test(i))
+                    mQueriesByComponent[i].push_back(query);
+            for (auto&& entity : mEntities)
+                if (Utils::IsEntityValid(entity.id))
+                    query->update(Utils::GetEntityIndex(entity.id), entity.mask, mTick);
+            return query;
+        }
+        // Update all queries for all entities. Used after the entity table was filled directly (see SceneSerializer::Load()).
+        void refreshQueries()
+        {
+            for (auto&& query : mQueries)
+                for (auto&& entity : mEntities)
+                    if (Utils::IsEntityValid(entity.id))
+                        query->update(Utils::GetEntityIndex(entity.id), entity.mask, mTick);
+        }
+
         template<typename... TComponents> friend class SceneView;
+        template<typename... TFilters> friend class CachedQuery;
+        friend class SceneSerializer;
     };
 }
\ No newline at end of file
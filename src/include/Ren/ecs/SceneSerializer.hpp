@@ -0,0 +1,101 @@
+#pragma once
+#include <cstdint>      // uint8_t, uint32_t
+#include <string>       // std::string
+#include <vector>       // std::vector
+#include <functional>   // std::function
+#include <type_traits>  // std::is_trivially_copyable_v
+#include <cstring>      // std::memcpy
+#include <new>          // placement new
+#include "Scene.hpp"
+
+namespace Ren::ecs
+{
+    // Saves scene into versioned binary file and loads it back.
+    // - Components are stored as columns (one per component type), which are identified by the name they were registered with.
+    //   Components, which were not registered, are not saved.
+    // - Trivially copyable components are stored as raw bytes and loaded by copying whole column into the pool at once.
+    //   Other components have to provide their own functions for saving and loading single component.
+    // - Entity table is stored as is, so entity IDs (and references to entities stored in components) stay valid after loading.
+    // - File is memory-mapped during loading. Its content is validated and the scene is left empty, if the loading fails.
+    class SceneSerializer
+    {
+    public:
+        // Version of the file format. Files with different version are refused.
+        static constexpr uint32_t FORMAT_VERSION = 1;
+
+        // Register trivially copyable component, which will be stored as raw bytes.
+        template<typename TComponent>
+        static void RegisterComponent(const std::string& name)
+        {
+            static_assert(std::is_trivially_copyable_v<TComponent>, "Component must be trivially copyable. Provide save and load functions instead.");
+            registerComponent({ name, Utils::GetId<TComponent>(), std::is_empty_v<TComponent> ? 0 : uint32_t(sizeof(TComponent)), &ComponentPool::Create<TComponent>, nullptr, nullptr });
+        }
+        // Register component with custom functions for saving and loading single component.
+        // - save appends the component's data to the output.
+        // - load reads the component's data from [data, end) into default constructed component and returns pointer past the read data.
+        //   Returns nullptr, if the data is invalid or would be read past the end (the Read() helpers do that).
+        template<typename TComponent>
+        static void RegisterComponent(const std::string& name, void (*save)(const TComponent&, std::vector<uint8_t>&), const uint8_t* (*load)(TComponent&, const uint8_t*, const uint8_t*))
+        {
+            registerComponent({ name, Utils::GetId<TComponent>(), uint32_t(sizeof(TComponent)), &ComponentPool::Create<TComponent>,
+                [save](const void* component, std::vector<uint8_t>& out) { save(*static_cast<const TComponent*>(component), out); },
+                [load](void* memory, const uint8_t* data, const uint8_t* end) { return load(*new(memory) TComponent(), data, end); }
+            });
+        }
+
+        // Save all entities and registered components of the scene. Returns false on failure.
+        static bool Save(Scene& scene, const char* filename);
+        // Load scene from file into empty scene. Returns false on failure.
+        static bool Load(Scene& scene, const char* filename);
+
+        // Helpers for custom save and load functions.
+        template<typename T>
+        static void Write(std::vector<uint8_t>& out, const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be written directly.");
+            const uint8_t* p_value = reinterpret_cast<const uint8_t*>(&value);
+            out.insert(out.end(), p_value, p_value + sizeof(T));
+        }
+        static void Write(std::vector<uint8_t>& out, const std::string& value)
+        {
+            Write(out, uint32_t(value.size()));
+            out.insert(out.end(), value.begin(), value.end());
+        }
+        // Read helpers return pointer past the read value, or nullptr if the value doesn't fit before end.
+        // Passing nullptr as data returns nullptr, so the reads can be chained and checked once at the end.
+        template<typename T>
+        static const uint8_t* Read(const uint8_t* data, const uint8_t* end, T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values can be read directly.");
+            if (!data || size_t(end - data) < sizeof(T))
+                return nullptr;
+            std::memcpy(&value, data, sizeof(T));
+            return data + sizeof(T);
+        }
+        static const uint8_t* Read(const uint8_t* data, const uint8_t* end, std::string& value)
+        {
+            uint32_t size = 0;
+            data = Read(data, end, size);
+            if (!data || size_t(end - data) < size)
+                return nullptr;
+            value.assign(reinterpret_cast<const char*>(data), size);
+            return data + size;
+        }
+
+    private:
+        struct component_desc {
+            std::string name;
+            int component_id;
+            // Size of the component. Is 0 for tags.
+            uint32_t element_size;
+            ComponentPool* (*create_pool)();
+            // Custom serialization. Both are empty for components stored as raw bytes.
+            std::function<void(const void*, std::vector<uint8_t>&)> save;
+            std::function<const uint8_t*(void*, const uint8_t*, const uint8_t*)> load;
+        };
+
+        static void registerComponent(component_desc desc);
+        // Registered components. Built-in components are registered on first use.
+        static std::vector<component_desc>& registry();
+    };
+}
@@ -1,18 +1,98 @@
 #pragma once
 #include "Scene.hpp"
+#include "Ren/ThreadPool.hpp"
+#include <array>    // std::array
+#include <utility>  // std::index_sequence
+#include <atomic>   // std::atomic
+#include <algorithm>    // std::min
+#include <type_traits>  // std::conditional_t
 
 namespace Ren::ecs
 {
+    // Chunks processed by SceneView::ParallelEach() always contain multiple of this many entities,
+    // so that dense arrays written by different threads don't share cache lines.
+    const uint32_t PARALLEL_CHUNK_ALIGN = 64;
+
+    // Filters, which can be used in place of component types in the SceneView. Entity must have the component and
+    // the component must have been added (or changed) at the view's since_tick or later. The component itself is still passed to each().
+    // - The scene tick is advanced by the SystemsManager after the update (before playing back the commands) and after the rendering.
+    //   There is no default since_tick. Every system keeps the tick, up to which it has seen the changes, and passes it to the view:
+    //       ChangeTick since = mLastTick;
+    //       mLastTick = scene.GetTick() + 1; // Changes of the current tick are processed now.
+    //       SceneView<Changed<Transform2D>, SpriteRenderer>(scene, since).each(...);
+    //   This way changes made during the update are seen in the render and the other way around. Changes made in the current tick
+    //   after the view was iterated are not seen (see TransformSystem).
+    // Example:
+    //     SceneView<Changed<Transform2D>, SpriteRenderer>(scene, since).each([](EntityID id, const Transform2D& t, const SpriteRenderer& s) { ... });
+    template<typename TComponent> struct Added {};
+    template<typename TComponent> struct Changed {};
+    // Components are passed to each() as const references. Component wrapped in Mut<> is passed as a mutable reference
+    // and is marked as changed in the current tick for every visited entity, so that the writes are seen by Changed<> filters.
+    // - Can be used in the SceneView and in the With<> and Optional<> filters of Scene::Query(). Cannot be combined with Added<> or Changed<>.
+    // Example:
+    //     SceneView<Mut<Transform2D>, Velocity>(scene).each([](EntityID id, Transform2D& t, const Velocity& v) { ... });
+    template<typename TComponent> struct Mut {};
+
+    namespace Utils
+    {
+        enum class ViewFilter : int { None = 0, Added, Changed };
+
+        // Get component type, filter and mutability from type used in the SceneView.
+        template<typename T> struct ViewTraits { using Component = T; static constexpr ViewFilter Filter = ViewFilter::None; static constexpr bool Mutable = false; };
+        template<typename T> struct ViewTraits<Mut<T>> { using Component = T; static constexpr ViewFilter Filter = ViewFilter::None; static constexpr bool Mutable = true; };
+        template<typename T> struct ViewTraits<Added<T>>
+        {
+            static_assert(!ViewTraits<T>::Mutable, "Mut<> cannot be combined with Added<>.");
+            using Component = T; static constexpr ViewFilter Filter = ViewFilter::Added; static constexpr bool Mutable = false;
+        };
+        template<typename T> struct ViewTraits<Changed<T>>
+        {
+            static_assert(!ViewTraits<T>::Mutable, "Mut<> cannot be combined with Changed<>.");
+            using Component = T; static constexpr ViewFilter Filter = ViewFilter::Changed; static constexpr bool Mutable = false;
+        };
+
+        template<typename T>
+        using ViewComponent = typename ViewTraits<T>::Component;
+        // Type in which the component is passed to each(). Only Mut<> components can be modified.
+        template<typename T>
+        using ViewRef = std::conditional_t<ViewTraits<T>::Mutable, ViewComponent<T>&, const ViewComponent<T>&>;
+        template<typename T>
+        using ViewPtr = std::conditional_t<ViewTraits<T>::Mutable, ViewComponent<T>*, const ViewComponent<T>*>;
+
+        // Return component at given position in the pool as it is passed to each(). Mut<> component is marked as changed.
+        template<typename T>
+        inline ViewRef<T> ViewAt(ComponentPool* pool, uint32_t dense_i, ChangeTick tick)
+        {
+            if constexpr (ViewTraits<T>::Mutable)
+                pool->set_changed(dense_i, tick);
+            return *static_cast<ViewComponent<T>*>(pool->at(dense_i));
+        }
+    }
+
     // SceneView is an object, that is used for iterating through the scene.
     // For example we could iterate only through entities that have certain components attached etc.
+    // Components can be wrapped in Added<>, Changed<> or Mut<> (see above).
     // Example:
     //     for (auto&& entity_id : SceneView<Transform, SpriteRenderer>(scene)) do_stuff...
+    // Or using the dense iteration, which is preferred for scenes with many entities:
+    //     SceneView<Mut<Transform>, SpriteRenderer>(scene).each([](EntityID id, Transform& t, const SpriteRenderer& s) { do_stuff... });
     template<typename... TComponents>
     class SceneView
     {
     public:
+        // True if some of the components is wrapped in Added<> or Changed<> filter.
+        static constexpr bool HAS_FILTERS = ((Utils::ViewTraits<TComponents>::Filter != Utils::ViewFilter::None) || ...);
+
+        // View without Added<> and Changed<> filters.
         SceneView(Scene& scene)
+            : SceneView(scene, 0)
+        {
+            static_assert(!HAS_FILTERS, "SceneView with Added<> or Changed<> filters requires since_tick.");
+        }
+        // Added<> and Changed<> filters match components added or changed at since_tick or later.
+        SceneView(Scene& scene, ChangeTick since_tick)
             : mpScene(&scene)
+            , mSinceTick(since_tick)
         {
             // If no types are provided, then iterate through all of the components.
             if (sizeof...(TComponents) == 0)
@@ -21,7 +101,7 @@ namespace Ren::ecs
             {
                 // Unpack the component types into array of theirs IDs. And prepare the corresponding mask.
                 // Provide the 0, to avoid compilation error in case no types are provided.
-                int component_ids[] = { 0, Utils::GetId<TComponents>()... };
+                int component_ids[] = { 0, Utils::GetId<Utils::ViewComponent<TComponents>>()... };
                 for (uint32_t i = 1; i < sizeof...(TComponents) + 1; i++)
                     mComponentMask.set(component_ids[i]);
             }
@@ -35,12 +115,15 @@ namespace Ren::ecs
             // Described below. Has the same purpose, but iterator needs to store its own data.
             ComponentMask mask;
             bool all{ false };
+            // View used for checking the filters.
+            SceneView* pView;
 
-            Iterator(Scene* scene, EntityIndex index, ComponentMask mask, bool all)
+            Iterator(Scene* scene, EntityIndex index, ComponentMask mask, bool all, SceneView* view)
                 : index(index)
                 , pScene(scene)
                 , mask(mask)
-                , all(all) {}
+                , all(all)
+                , pView(view) {}
             
             EntityID operator*() const
             {
@@ -68,22 +151,71 @@ namespace Ren::ecs
             // Helper function used to check validity of the index.
             bool ValidIndex()
             {
-                return Utils::IsEntityValid(pScene->mEntities[index].id) && (all || mask == (mask & pScene->mEntities[index].mask));
+                return Utils::IsEntityValid(pScene->mEntities[index].id) && (all || mask == (mask & pScene->mEntities[index].mask))
+                    && pView->passesFilters(index);
             }
         };
 
         const Iterator begin()
         {
             // Find first entity that has required components.
-            EntityIndex first_index = 0;
-            while (first_index < EntityIndex(mpScene->mEntities.size())
-                && (mComponentMask != (mComponentMask & mpScene->mEntities[first_index].mask) || !Utils::IsEntityValid(mpScene->mEntities[first_index].id)))
-                first_index++;
-            return Iterator(mpScene, first_index, mComponentMask, mAll);
+            Iterator it(mpScene, 0, mComponentMask, mAll, this);
+            if (!mpScene->mEntities.empty() && !it.ValidIndex())
+                ++it;
+            return it;
         }
         const Iterator end()
         {
-            return Iterator(mpScene, EntityIndex(mpScene->mEntities.size()), mComponentMask, mAll);
+            return Iterator(mpScene, EntityIndex(mpScene->mEntities.size()), mComponentMask, mAll, this);
+        }
+
+        // Call func(EntityID, const TComponents&...) for every entity, which has all the components and passes the filters.
+        // Mut<> components are passed as mutable references and marked as changed.
+        // Walks the dense array of the smallest component pool, so only entities which have at least
+        // that component are visited. Components are passed directly from the pools, without going through Scene::Get().
+        // - Entities and components must not be added or removed during the iteration.
+        template<typename TFunc>
+        void each(TFunc&& func)
+        {
+            static_assert(sizeof...(TComponents) > 0, "SceneView::each() requires at least one component type.");
+            pool_array pools;
+            size_t driver;
+            if (selectPools(pools, driver))
+                eachRange(func, pools, driver, 0, uint32_t(pools[driver]->size()), std::index_sequence_for<TComponents...>{});
+        }
+        // Same as each(), but the entities are split into chunks, which are processed in parallel on the thread pool.
+        // Returns when all the chunks are processed. Use PerThread to collect results without locking.
+        // - If chunk_size is 0, it is picked so that every thread gets a few chunks to balance the load.
+        // - func is called concurrently, so it must only touch the components passed to it (or synchronize by itself).
+        // - Entities and components must not be added or removed during the iteration.
+        template<typename TFunc>
+        void ParallelEach(TFunc&& func, uint32_t chunk_size = 0, ThreadPool& pool = ThreadPool::Get())
+        {
+            static_assert(sizeof...(TComponents) > 0, "SceneView::ParallelEach() requires at least one component type.");
+            pool_array pools;
+            size_t driver;
+            if (!selectPools(pools, driver))
+                return;
+
+            uint32_t count = uint32_t(pools[driver]->size());
+            if (chunk_size == 0)
+                chunk_size = count / (pool.GetThreadCount() * 4);
+            chunk_size = std::max(PARALLEL_CHUNK_ALIGN, (chunk_size + PARALLEL_CHUNK_ALIGN - 1) / PARALLEL_CHUNK_ALIGN * PARALLEL_CHUNK_ALIGN);
+            uint32_t chunk_count = (count + chunk_size - 1) / chunk_size;
+
+            if (chunk_count <= 1 || pool.GetWorkerCount() == 0)
+            {
+                eachRange(func, pools, driver, 0, count, std::index_sequence_for<TComponents...>{});
+                return;
+            }
+
+            std::atomic<uint32_t> remaining{ chunk_count };
+            for (uint32_t chunk = 0; chunk < chunk_count; chunk++)
+                pool.Submit([&, chunk] {
+                    eachRange(func, pools, driver, chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size), std::index_sequence_for<TComponents...>{});
+                    remaining--;
+                });
+            pool.WaitUntil([&remaining] { return remaining == 0; });
         }
 
     private:
@@ -92,5 +224,73 @@ namespace Ren::ecs
         bool mAll{ false };
         // When selecting only entities with some components, we use this mask to check for them.
         ComponentMask mComponentMask;
+        ChangeTick mSinceTick;
+
+        typedef std::array<ComponentPool*, sizeof...(TComponents)> pool_array;
+
+        // Get pools of all the components and pick the one with the least components to drive the iteration.
+        // Returns false if no entity can match.
+        bool selectPools(pool_array& pools, size_t& driver)
+        {
+            pools = { mpScene->getPool<Utils::ViewComponent<TComponents>>()... };
+            driver = 0;
+            for (size_t i = 0; i < pools.size(); i++)
+            {
+                // Some component was never assigned, so no entity can match.
+                if (pools[i] == nullptr)
+                    return false;
+                if (pools[i]->size() < pools[driver]->size())
+                    driver = i;
+            }
+            return true;
+        }
+        // Call func for matching entities at positions [begin, end) of the driving pool's dense array.
+        template<typename TFunc, size_t... I>
+        void eachRange(TFunc& func, const pool_array& pools, size_t driver, uint32_t begin, uint32_t end, std::index_sequence<I...>)
+        {
+            const EntityIndex* entities = pools[driver]->entities();
+            ChangeTick tick = mpScene->GetTick();
+            for (uint32_t dense_i = begin; dense_i < end; dense_i++)
+            {
+                EntityIndex index = entities[dense_i];
+
+                // Find positions of the entity's components in the other pools.
+                std::array<uint32_t, sizeof...(TComponents)> positions = { (I == driver ? dense_i : pools[I]->dense_index(index))... };
+                bool has_all = true;
+                for (auto&& pos : positions)
+                    has_all = has_all && pos != ComponentPool::INVALID_DENSE;
+                if (!has_all || !(passesFilter<TComponents>(pools[I], positions[I]) && ...))
+                    continue;
+
+                func(mpScene->mEntities[index].id, Utils::ViewAt<TComponents>(pools[I], positions[I], tick)...);
+            }
+        }
+        // Check filter of given view type for the component at given position in the pool.
+        template<typename T>
+        inline bool passesFilter(const ComponentPool* pool, uint32_t dense_i) const
+        {
+            if constexpr (Utils::ViewTraits<T>::Filter == Utils::ViewFilter::Added)
+                return pool->added_tick(dense_i) >= mSinceTick;
+            else if constexpr (Utils::ViewTraits<T>::Filter == Utils::ViewFilter::Changed)
+                return pool->changed_tick(dense_i) >= mSinceTick;
+            else
+                return true;
+        }
+        // Check all filters for entity, which has all the components.
+        bool passesFilters(EntityIndex index)
+        {
+            return (passesEntityFilter<TComponents>(index) && ...);
+        }
+        template<typename T>
+        inline bool passesEntityFilter(EntityIndex index)
+        {
+            if constexpr (Utils::ViewTraits<T>::Filter == Utils::ViewFilter::None)
+                return true;
+            else
+            {
+                const ComponentPool* pool = mpScene->getPool<Utils::ViewComponent<T>>();
+                return passesFilter<T>(pool, pool->dense_index(index));
+            }
+        }
     };
 }
\ No newline at end of file
@@ -0,0 +1,244 @@
+#pragma once
+#include <cstdint>          // uint32_t, uint64_t, int32_t
+#include <cmath>            // std::floor, std::sqrt
+#include <vector>           // std::vector
+#include <unordered_map>    // std::unordered_map
+#include <limits>           // std::numeric_limits
+#include <algorithm>        // std::max
+#include "Ren/AABB.hpp"
+#include "Scene.hpp"        // EntityID
+
+namespace Ren::ecs
+{
+    // Loose uniform grid of entity bounding boxes, used for range queries (culling, picking, neighbours).
+    // - Every box is stored in the cell containing its center. Queries are expanded by half of the cell size,
+    //   so boxes that stick out of their cell are still found. Boxes larger than a cell are kept in a separate list.
+    // - Cells are stored in a hash map, so the grid is unbounded and empty areas cost nothing.
+    // - Entities are identified by their index, so the index holds at most one box per entity index.
+    // - Queries are const and can be run from multiple threads at once, as long as nobody modifies the index.
+    class SpatialIndex
+    {
+    public:
+        // Cell size should be about the size of the common entity. Smaller cells mean more cells visited per query,
+        // larger cells mean more boxes tested.
+        explicit SpatialIndex(float cell_size = 128.0f)
+            : mCellSize(cell_size) {}
+
+        inline float GetCellSize() const { return mCellSize; }
+        // Number of entities in the index.
+        inline size_t Size() const { return mCount; }
+        inline bool Contains(EntityID id) const
+        {
+            EntityIndex index = Utils::GetEntityIndex(id);
+            return index < mLocations.size() && mLocations[index].slot != INVALID_SLOT && getEntry(mLocations[index]).id == id;
+        }
+
+        // Insert the entity or update its box, if it is already in the index.
+        void Update(EntityID id, const AABB2D& box)
+        {
+            EntityIndex index = Utils::GetEntityIndex(id);
+            if (index >= mLocations.size())
+                mLocations.resize(index + 1);
+
+            location& loc = mLocations[index];
+            bool large = isLarge(box);
+            uint64_t key = large ? 0 : cellKey(cellCoord(box.GetCenter().x), cellCoord(box.GetCenter().y));
+            if (loc.slot != INVALID_SLOT)
+            {
+                // Stays in the same cell, so just update the box.
+                if (loc.large == large && (large || loc.key == key))
+                {
+                    getEntry(loc) = { id, box };
+                    return;
+                }
+                erase(loc);
+            }
+
+            std::vector<entry>& entries = large ? mLarge : mCells[key];
+            loc = { key, uint32_t(entries.size()), large };
+            entries.push_back({ id, box });
+            mCount++;
+            if (!large)
+            {
+                int32_t x = cellCoord(box.GetCenter().x), y = cellCoord(box.GetCenter().y);
+                mCellMin = mCells.size() == 1 ? glm::ivec2(x, y) : glm::min(mCellMin, glm::ivec2(x, y));
+                mCellMax = mCells.size() == 1 ? glm::ivec2(x, y) : glm::max(mCellMax, glm::ivec2(x, y));
+            }
+        }
+        void Remove(EntityID id)
+        {
+            if (Contains(id))
+                erase(mLocations[Utils::GetEntityIndex(id)]);
+        }
+        // Remove entity stored at given entity index, whatever its version is (e.g. after the entity was destroyed).
+        void RemoveIndex(EntityIndex index)
+        {
+            if (index < mLocations.size() && mLocations[index].slot != INVALID_SLOT)
+                erase(mLocations[index]);
+        }
+        // Remove all entities for which pred(EntityID) returns true.
+        template<typename TPred>
+        void RemoveIf(TPred&& pred)
+        {
+            // Entities are collected first, because erase() deletes the cell once it gets empty.
+            mRemoved.clear();
+            auto collect = [&](const std::vector<entry>& entries) {
+                for (auto&& e : entries)
+                    if (pred(e.id))
+                        mRemoved.push_back(e.id);
+            };
+            collect(mLarge);
+            for (auto&& [key, entries] : mCells)
+                collect(entries);
+            for (auto&& id : mRemoved)
+                erase(mLocations[Utils::GetEntityIndex(id)]);
+        }
+        void Clear()
+        {
+            mCells.clear();
+            mLarge.clear();
+            mLocations.clear();
+            mCount = 0;
+        }
+
+        // Call func(EntityID, const AABB2D&) for every entity, whose box overlaps the given box.
+        template<typename TFunc>
+        void QueryAABB(const AABB2D& box, TFunc&& func) const
+        {
+            for (auto&& e : mLarge)
+                if (e.box.Overlaps(box))
+                    func(e.id, e.box);
+            if (mCells.empty())
+                return;
+
+            // Boxes can stick out of their cell by half of the cell size.
+            float loose = 0.5f * mCellSize;
+            int32_t x0 = std::max(cellCoord(box.min.x - loose), mCellMin.x), x1 = std::min(cellCoord(box.max.x + loose), mCellMax.x);
+            int32_t y0 = std::max(cellCoord(box.min.y - loose), mCellMin.y), y1 = std::min(cellCoord(box.max.y + loose), mCellMax.y);
+            for (int32_t y = y0; y <= y1; y++)
+                for (int32_t x = x0; x <= x1; x++)
+                {
+                    auto it = mCells.find(cellKey(x, y));
+                    if (it == mCells.end())
+                        continue;
+                    for (auto&& e : it->second)
+                        if (e.box.Overlaps(box))
+                            func(e.id, e.box);
+                }
+        }
+        void QueryAABB(const AABB2D& box, std::vector<EntityID>& out) const
+        {
+            QueryAABB(box, [&out](EntityID id, const AABB2D&) { out.push_back(id); });
+        }
+        // Call func(EntityID, const AABB2D&) for every entity, whose box contains the point.
+        template<typename TFunc>
+        void QueryPoint(glm::vec2 point, TFunc&& func) const
+        {
+            QueryAABB({ point, point }, func);
+        }
+        void QueryPoint(glm::vec2 point, std::vector<EntityID>& out) const
+        {
+            QueryAABB({ point, point }, out);
+        }
+        // Return entity, whose box is closest to the point (distance is 0 for boxes containing the point).
+        // Returns INVALID_ENTITY if there is no entity within max_distance.
+        // - accept(EntityID) can be used to skip some entities, e.g. the one asking for its neighbour.
+        template<typename TFunc>
+        EntityID QueryNearest(glm::vec2 point, float max_distance, TFunc&& accept) const
+        {
+            EntityID best = INVALID_ENTITY;
+            float best_dist2 = max_distance * max_distance;
+            auto test = [&](const entry& e) {
+                float dist2 = e.box.Distance2(point);
+                if (dist2 <= best_dist2 && (best == INVALID_ENTITY || dist2 < best_dist2) && accept(e.id))
+                {
+                    best = e.id;
+                    best_dist2 = dist2;
+                }
+            };
+            for (auto&& e : mLarge)
+                test(e);
+            if (mCells.empty())
+                return best;
+
+            // Search rings of cells around the point's cell. Box in ring r has its center at least (r - 1) cells away
+            // and sticks out of its cell by at most half a cell, so the search stops once the ring can't contain anything closer.
+            int32_t px = cellCoord(point.x), py = cellCoord(point.y);
+            int32_t max_ring = std::max(std::max(std::abs(px - mCellMin.x), std::abs(px - mCellMax.x)), std::max(std::abs(py - mCellMin.y), std::abs(py - mCellMax.y)));
+            for (int32_t r = 0; r <= max_ring; r++)
+            {
+                float ring_dist = (float(r) - 1.5f) * mCellSize;
+                if (ring_dist > 0.0f && ring_dist * ring_dist > best_dist2)
+                    break;
+                for (int32_t y = py - r; y <= py + r; y++)
+                {
+                    // Only the border of the ring is visited.
+                    int32_t step = (y == py - r || y == py + r) ? 1 : 2 * r;
+                    for (int32_t x = px - r; x <= px + r; x += std::max(step, 1))
+                    {
+                        auto it = mCells.find(cellKey(x, y));
+                        if (it == mCells.end())
+                            continue;
+                        for (auto&& e : it->second)
+                            test(e);
+                    }
+                }
+            }
+            return best;
+        }
+        EntityID QueryNearest(glm::vec2 point, float max_distance = std::numeric_limits<float>::max()) const
+        {
+            return QueryNearest(point, max_distance, [](EntityID) { return true; });
+        }
+
+    private:
+        static constexpr uint32_t INVALID_SLOT = uint32_t(-1);
+
+        struct entry {
+            EntityID id;
+            AABB2D box;
+        };
+        // Where the entity's entry is stored.
+        struct location {
+            uint64_t key = 0;
+            uint32_t slot = INVALID_SLOT;
+            bool large = false;
+        };
+
+        float mCellSize;
+        std::unordered_map<uint64_t, std::vector<entry>> mCells;
+        // Boxes larger than a cell.
+        std::vector<entry> mLarge;
+        // Location of entry of every entity index.
+        std::vector<location> mLocations;
+        size_t mCount{ 0 };
+        // Range of cells, which contained a box since the grid was last empty. Limits the queries.
+        glm::ivec2 mCellMin{ 0, 0 }, mCellMax{ 0, 0 };
+        // Entities matched by RemoveIf(). Kept to reuse the memory.
+        std::vector<EntityID> mRemoved;
+
+        inline int32_t cellCoord(float v) const { return int32_t(std::floor(v / mCellSize)); }
+        static inline uint64_t cellKey(int32_t x, int32_t y) { return uint64_t(uint32_t(x)) << 32 | uint64_t(uint32_t(y)); }
+        inline bool isLarge(const AABB2D& box) const { return box.max.x - box.min.x > mCellSize || box.max.y - box.min.y > mCellSize; }
+
+        inline std::vector<entry>& getEntries(const location& loc) { return loc.large ? mLarge : mCells.find(loc.key)->second; }
+        inline entry& getEntry(const location& loc) { return getEntries(loc)[loc.slot]; }
+        inline const entry& getEntry(const location& loc) const { return (loc.large ? mLarge : mCells.find(loc.key)->second)[loc.slot]; }
+
+        // Remove entry at given location. Last entry of the cell is moved into its place.
+        void erase(location& loc)
+        {
+            std::vector<entry>& entries = getEntries(loc);
+            if (loc.slot != entries.size() - 1)
+            {
+                entries[loc.slot] = entries.back();
+                mLocations[Utils::GetEntityIndex(entries[loc.slot].id)].slot = loc.slot;
+            }
+            entries.pop_back();
+            if (entries.empty() && !loc.large)
+                mCells.erase(loc.key);
+            loc.slot = INVALID_SLOT;
+            mCount--;
+        }
+    };
+}
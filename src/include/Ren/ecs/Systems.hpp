@@ -1,10 +1,17 @@
 #pragma once
 #include <Ren/Renderer/Renderer.h>
 #include <Ren/InputInterface.hpp>
+#include <Ren/ThreadPool.hpp>
 #include <vector>             // std::vector
 #include <unordered_map>
+#include <atomic>             // std::atomic
+#include <memory>             // std::unique_ptr
+#include <algorithm>          // std::find_if
+#include <optional>           // std::optional
 #include "Components.hpp"
 #include "SceneView.hpp"    // Scene, SceneView
+#include "Query.hpp"        // Scene::Query()
+#include "SpatialIndex.hpp"
 
 
 /*
@@ -16,6 +23,44 @@ namespace Ren::ecs
     using Transform2D = components::Transform2D;
     using SpriteRenderer = components::SpriteRenderer;
     using Script = components::Script;
+    using Parent = components::Parent;
+    using Children = components::Children;
+    using WorldTransform2D = components::WorldTransform2D;
+
+    // Shared data accessed by the systems, which is not a component (e.g. SpatialIndex). Identified by type, like components.
+    const int MAX_RESOURCES = 32;
+    typedef std::bitset<MAX_RESOURCES> ResourceMask;
+    namespace Utils
+    {
+        inline std::atomic<int> resource_count{ 0 };
+        template<typename T>
+        int GetResourceId()
+        {
+            static int s_resource_id = resource_count++;
+            REN_ASSERT(s_resource_id < MAX_RESOURCES, "Too many resource types.");
+            return s_resource_id;
+        }
+    }
+
+    // Components and resources accessed by the system in its Update() method.
+    struct SystemAccess
+    {
+        ComponentMask reads;
+        ComponentMask writes;
+        ResourceMask reads_resources;
+        ResourceMask writes_resources;
+        // Systems which did not declare their access can touch anything, so they are never run in parallel with other systems.
+        bool declared{ false };
+
+        // Check if two systems cannot run at the same time.
+        bool ConflictsWith(const SystemAccess& other) const
+        {
+            if (!declared || !other.declared)
+                return true;
+            return (writes & (other.reads | other.writes)).any() || (other.writes & reads).any()
+                || (writes_resources & (other.reads_resources | other.writes_resources)).any() || (other.writes_resources & reads_resources).any();
+        }
+    };
 
     // Parent class for all systems. You can also create your own systems.
     class System
@@ -29,13 +74,44 @@ namespace Ren::ecs
         virtual void Render() {};
 
         virtual void SetScene(Scene* p_scene) { mpActiveScene = p_scene; }
+        inline const SystemAccess& GetAccess() const { return mAccess; }
     protected:
         Scene* mpActiveScene{ nullptr };
+        SystemAccess mAccess;
+        // Per-thread command buffers of the SystemsManager, which manages this system.
+        PerThread<EntityCommandBuffer>* mpCommandBuffers{ nullptr };
+        // Thread pool the command buffers are bound to. Work, which records commands from multiple threads, must run on it.
+        ThreadPool* mpThreadPool{ nullptr };
+
+        // Command buffer of the current thread. Commands are applied by SystemsManager after the current phase
+        // (ProcessInput or Update) of all systems finishes.
+        inline EntityCommandBuffer& commands()
+        {
+            REN_ASSERT(mpCommandBuffers, "System is not managed by SystemsManager.");
+            return mpCommandBuffers->Local();
+        }
+
+        // Declare components, which are read or written in Update(). Should be called from the constructor.
+        // Systems with declared access are updated in parallel with systems they don't conflict with.
+        // - Such systems must not create or destroy entities, nor assign or remove components in Update() directly. Use commands() instead.
+        template<typename... TComponents>
+        void Reads() { (mAccess.reads.set(Utils::GetId<TComponents>()), ...); mAccess.declared = true; }
+        template<typename... TComponents>
+        void Writes() { (mAccess.writes.set(Utils::GetId<TComponents>()), ...); mAccess.declared = true; }
+        // Declare resources (shared data other than components), which are read or written in Update().
+        template<typename... TResources>
+        void ReadsResource() { (mAccess.reads_resources.set(Utils::GetResourceId<TResources>()), ...); mAccess.declared = true; }
+        template<typename... TResources>
+        void WritesResource() { (mAccess.writes_resources.set(Utils::GetResourceId<TResources>()), ...); mAccess.declared = true; }
+
+        friend class SystemsManager;
     };
 
     class RenderSystem : public System
     {
     public:
+        RenderSystem() { Reads<Transform2D, SpriteRenderer, WorldTransform2D>(); }
+
         void Init()
         {
             // Get renderer.
@@ -44,7 +120,7 @@ namespace Ren::ecs
             // Load and preapre all textures.
             for (const auto&& ent : SceneView<Transform2D, SpriteRenderer>(*mpActiveScene))
             {
-                auto p_sprite_renderer = mpActiveScene->Get<SpriteRenderer>(ent);
+                auto p_sprite_renderer = mpActiveScene->GetMut<SpriteRenderer>(ent);
                 if (p_sprite_renderer && p_sprite_renderer->image_path != SpriteRenderer::IMAGE_NONE)
                 {
                     auto tex = RawTexture::Load(p_sprite_renderer->image_path.c_str());
@@ -70,26 +146,60 @@ namespace Ren::ecs
         }
         void Render()
         {
-            for (const auto&& ent : SceneView<Transform2D, SpriteRenderer>(*mpActiveScene))
-            {
-                auto p_trans = mpActiveScene->Get<Transform2D>(ent);
-                auto p_sprite = mpActiveScene->Get<SpriteRenderer>(ent);
+            // Sprites of the same layer are ordered by their entity index, so the drawing order doesn't depend on which thread submitted them.
+            auto submit = [this](EntityID ent, const Transform2D& trans, const SpriteRenderer& sprite) {
+                uint32_t order = Utils::GetEntityIndex(ent);
+                // Entities in the transform hierarchy are rendered in the world space.
+                if (const WorldTransform2D* p_world = mpActiveScene->Get<WorldTransform2D>(ent))
+                    renderer_2d->SubmitQuad({ p_world->GetPosition(trans.scale), trans.scale, p_world->GetRotation() }, { sprite.color, sprite.tex_id }, trans.layer, order);
+                else
+                    renderer_2d->SubmitQuad({ trans.position, trans.scale, trans.rotation }, { sprite.color, sprite.tex_id }, trans.layer, order);
+            };
 
-                renderer_2d->SubmitQuad({ p_trans->position, p_trans->scale, p_trans->rotation }, { p_sprite->color, p_sprite->tex_id }, p_trans->layer);
+            if (!mpSpatialIndex || !mCullingEnabled)
+            {
+                // Renderer has submission buffer for every thread of its pool, so the sprites can be submitted from that pool.
+                SceneView<Transform2D, SpriteRenderer> view(*mpActiveScene);
+                if (ThreadPool* p_pool = renderer_2d->GetThreadPool())
+                    view.ParallelEach(submit, 0, *p_pool);
+                else
+                    view.each(submit);
+                return;
             }
+            // Submit only entities overlapping the view.
+            mpSpatialIndex->QueryAABB(mViewBounds, [&](EntityID ent, const AABB2D&) {
+                // Index can still contain entities destroyed after its last update.
+                auto [p_trans, p_sprite] = mpActiveScene->GetMultiple<Transform2D, SpriteRenderer>(ent);
+                if (p_trans && p_sprite)
+                    submit(ent, *p_trans, *p_sprite);
+            });
         }
+
+        // Use spatial index (see SpatialIndexSystem) to submit only the sprites inside the view bounds. Pass nullptr to disable it.
+        inline void SetSpatialIndex(const SpatialIndex* p_index) { mpSpatialIndex = p_index; }
+        // Area of the world, which is visible this frame. Culling is enabled once the bounds are set.
+        inline void SetViewBounds(const AABB2D& bounds) { mViewBounds = bounds; mCullingEnabled = true; }
+        inline void DisableCulling() { mCullingEnabled = false; }
     protected:
         Renderer2D* renderer_2d{ nullptr };
+        const SpatialIndex* mpSpatialIndex{ nullptr };
+        AABB2D mViewBounds;
+        bool mCullingEnabled{ false };
     };
 
+    // Scripts can access any component, so this system doesn't declare its access and is never updated in parallel with other systems.
     class ScriptSystem : public System
     {
     public:
+        // Update scripts of different entities in parallel. Should be enabled only if all
+        // scripts touch just their own entity and don't change the scene structure. Scripts are then run on the SystemsManager's thread pool.
+        inline void SetParallelUpdate(bool b) { mParallelUpdate = b; }
+
         void Init() override
         {
             for (auto&& ent : SceneView<Script>(*mpActiveScene))
             {
-                Script* s = mpActiveScene->Get<Script>(ent);
+                const Script* s = mpActiveScene->Get<Script>(ent);
                 for (auto&& script : s->scripts)
                     if (script)
                         script->Init();
@@ -99,7 +209,7 @@ namespace Ren::ecs
         {
             for (auto&& ent : SceneView<Script>(*mpActiveScene))
             {
-                Script* s = mpActiveScene->Get<Script>(ent);
+                const Script* s = mpActiveScene->Get<Script>(ent);
                 for (auto&& script : s->scripts)
                     if (script)
                         script->Destroy();
@@ -109,7 +219,7 @@ namespace Ren::ecs
         {
             for (auto&& ent : SceneView<Script>(*mpActiveScene))
             {
-                Script* s = mpActiveScene->Get<Script>(ent);
+                const Script* s = mpActiveScene->Get<Script>(ent);
                 for (auto&& script : s->scripts)
                     if (script)
                         script->ProcessInput(input);
@@ -117,13 +227,17 @@ namespace Ren::ecs
         };
         void Update(float dt) override
         {
-            for (auto&& ent : SceneView<Script>(*mpActiveScene))
-            {
-                Script* s = mpActiveScene->Get<Script>(ent);
-                for (auto&& script : s->scripts)
+            auto update = [dt](EntityID ent, const Script& s) {
+                for (auto&& script : s.scripts)
                     if (script)
                         script->Update(dt);
-            }
+            };
+
+            // Scripts record commands, so they must run on the pool their command buffers are bound to.
+            if (mParallelUpdate && mpThreadPool)
+                SceneView<Script>(*mpActiveScene).ParallelEach(update, 0, *mpThreadPool);
+            else
+                SceneView<Script>(*mpActiveScene).each(update);
         };
         void SetScene(Scene* p_scene) override
         {
@@ -133,19 +247,225 @@ namespace Ren::ecs
             mpActiveScene = p_scene;
             for (auto&& ent : SceneView<Script>(*mpActiveScene))
             {
-                Script* s = mpActiveScene->Get<Script>(ent);
+                const Script* s = mpActiveScene->Get<Script>(ent);
                 for (auto&& script : s->scripts) {
                     if (script) {
                         script->mpActiveScene = mpActiveScene;
                         script->mEntityID = ent;
+                        script->mpCommandBuffers = mpCommandBuffers;
+                        script->mpSpatialIndex = mpSpatialIndex;
                     }
                 }
             }
         };
+        // Make spatial index available to the scripts. Takes effect on the next SetScene().
+        inline void SetSpatialIndex(const SpatialIndex* p_index) { mpSpatialIndex = p_index; }
+    protected:
+        bool mParallelUpdate{ false };
+        const SpatialIndex* mpSpatialIndex{ nullptr };
+    };
+
+    // Computes WorldTransform2D of entities in the transform hierarchy.
+    // - Only subtrees, whose root's Transform2D or Parent changed since the last update, are recomputed.
+    //   Transform2D must be modified through Scene::GetMut() or Mut<> in views (or marked by Scene::MarkChanged()) for the change to be noticed.
+    // - Every change is processed once. Changes made in the same tick after the update (by systems updated later) are not seen,
+    //   so it should be added after the systems moving the entities. Commands are played back in the next tick, so they are seen.
+    // - Entities are processed ordered by their depth, so the parent is always computed before its children.
+    class TransformSystem : public System
+    {
+    public:
+        TransformSystem() { Reads<Transform2D, Parent, Children>(); Writes<WorldTransform2D>(); }
+
+        void Update(float dt) override
+        {
+            Scene& scene = *mpActiveScene;
+            ChangeTick since = mLastTick;
+            // Changes of the current tick are processed now, so the next update starts after it.
+            mLastTick = scene.GetTick() + 1;
+            mRun++;
+            for (auto&& bucket : mDepthBuckets)
+                bucket.clear();
+
+            // Collect roots of the dirty subtrees.
+            auto mark_dirty = [&](EntityID ent, auto&&...) { addToBucket(depthOf(scene, ent), ent); };
+            SceneView<Added<WorldTransform2D>>(scene, since).each(mark_dirty);
+            SceneView<Changed<Transform2D>, WorldTransform2D>(scene, since).each(mark_dirty);
+            SceneView<Changed<Parent>, WorldTransform2D>(scene, since).each(mark_dirty);
+
+            // Propagate from the top, adding children of every processed entity to the next depth.
+            for (uint32_t depth = 0; depth < mDepthBuckets.size(); depth++)
+            {
+                for (size_t i = 0; i < mDepthBuckets[depth].size(); i++)
+                {
+                    EntityID ent = mDepthBuckets[depth][i];
+                    EntityIndex index = Utils::GetEntityIndex(ent);
+                    if (mVisited[index] == mRun)
+                        continue;
+                    mVisited[index] = mRun;
+
+                    updateWorld(scene, ent);
+                    if (const Children* p_children = scene.Get<Children>(ent))
+                        for (auto&& child : p_children->entities)
+                            if (scene.Get<WorldTransform2D>(child))
+                                addToBucket(depth + 1, child);
+                }
+            }
+        }
+
+        // Make parent the parent of child in the transform hierarchy. Pass INVALID_ENTITY to make the child a root.
+        // Both entities get WorldTransform2D, if they don't have it already.
+        // - Changes the scene structure, so it must not be called during the iteration.
+        static void SetParent(Scene& scene, EntityID child, EntityID parent)
+        {
+            REN_ASSERT(child != parent, "Entity cannot be its own parent.");
+            for (EntityID ancestor = parent; ancestor != INVALID_ENTITY; )
+            {
+                const Parent* p_parent = scene.Get<Parent>(ancestor);
+                ancestor = p_parent ? p_parent->entity : INVALID_ENTITY;
+                REN_ASSERT(ancestor != child, "Setting the parent would create a cycle in the hierarchy.");
+            }
+
+            // Detach from the previous parent.
+            Parent* p_parent = scene.GetMut<Parent>(child);
+            if (p_parent && p_parent->entity != INVALID_ENTITY)
+                if (Children* p_children = scene.GetMut<Children>(p_parent->entity))
+                    p_children->entities.erase(std::remove(p_children->entities.begin(), p_children->entities.end(), child), p_children->entities.end());
+
+            if (!p_parent)
+                p_parent = scene.Assign<Parent>(child);
+            p_parent->entity = parent;
+            if (!scene.Get<WorldTransform2D>(child))
+                scene.Assign<WorldTransform2D>(child);
+
+            if (parent == INVALID_ENTITY)
+                return;
+            Children* p_children = scene.GetMut<Children>(parent);
+            if (!p_children)
+                p_children = scene.Assign<Children>(parent);
+            p_children->entities.push_back(child);
+            if (!scene.Get<WorldTransform2D>(parent))
+                scene.Assign<WorldTransform2D>(parent);
+        }
+
+    protected:
+        ChangeTick mLastTick{ 0 };
+        // Entities to process, bucketed by their depth in the hierarchy.
+        std::vector<std::vector<EntityID>> mDepthBuckets;
+        // Run in which the entity (by its index) was last processed. Used to process every entity only once per update.
+        std::vector<uint32_t> mVisited;
+        uint32_t mRun{ 0 };
+
+        void addToBucket(uint32_t depth, EntityID ent)
+        {
+            if (depth >= mDepthBuckets.size())
+                mDepthBuckets.resize(depth + 1);
+            mDepthBuckets[depth].push_back(ent);
+            if (Utils::GetEntityIndex(ent) >= mVisited.size())
+                mVisited.resize(Utils::GetEntityIndex(ent) + 1, 0);
+        }
+        // Number of ancestors, which are part of the hierarchy.
+        static uint32_t depthOf(Scene& scene, EntityID ent)
+        {
+            uint32_t depth = 0;
+            for (const Parent* p_parent = scene.Get<Parent>(ent); p_parent && scene.Get<WorldTransform2D>(p_parent->entity); p_parent = scene.Get<Parent>(p_parent->entity))
+                depth++;
+            return depth;
+        }
+        static void updateWorld(Scene& scene, EntityID ent)
+        {
+            WorldTransform2D* p_world = scene.GetMut<WorldTransform2D>(ent);
+            const Transform2D* p_trans = scene.Get<Transform2D>(ent);
+            glm::mat3x2 local = p_trans ? WorldTransform2D::FromLocal(*p_trans) : glm::mat3x2(1.0f);
+
+            const Parent* p_parent = scene.Get<Parent>(ent);
+            const WorldTransform2D* p_parent_world = p_parent ? scene.Get<WorldTransform2D>(p_parent->entity) : nullptr;
+            if (p_parent_world)
+            {
+                p_world->matrix = WorldTransform2D::Combine(p_parent_world->matrix, local);
+                p_world->depth = p_parent_world->depth + 1;
+            }
+            else
+            {
+                p_world->matrix = local;
+                p_world->depth = 0;
+            }
+        }
+    };
+
+    // Keeps SpatialIndex of all entities with Transform2D up to date.
+    // - Bounding box of entity is its quad (position, scale and rotation), in world space if it has WorldTransform2D.
+    // - Only entities whose Transform2D or WorldTransform2D changed since the last update are reinserted.
+    //   Transform2D must be modified through Scene::GetMut() or Mut<> in views (or marked by Scene::MarkChanged()) for the change to be noticed.
+    // - Should be added after TransformSystem and systems moving the entities, so the index matches the current frame.
+    // - Entities, which were destroyed or lost their Transform2D, are removed on the next update.
+    // - Systems using the index in Update() should declare ReadsResource<SpatialIndex>(), so they don't run in parallel with this system.
+    class SpatialIndexSystem : public System
+    {
+    public:
+        SpatialIndexSystem() { Reads<Transform2D, WorldTransform2D>(); WritesResource<SpatialIndex>(); }
+
+        inline const SpatialIndex& GetIndex() const { return mIndex; }
+        // Change cell size of the index. Index is rebuilt on the next update.
+        void SetCellSize(float cell_size)
+        {
+            mIndex = SpatialIndex(cell_size);
+            mLastTick = 0;
+        }
+        void SetScene(Scene* p_scene) override
+        {
+            mpActiveScene = p_scene;
+            mIndex.Clear();
+            mLastTick = 0;
+            // Query is registered here, as registering mutates the scene and Update() can run in parallel with other systems.
+            mQuery.reset();
+            if (p_scene)
+            {
+                mQuery.emplace(p_scene->Query<With<Transform2D>>());
+                mQuery->TrackRemoved();
+                mQuery->ConsumeRemoved([](EntityIndex) {});
+            }
+        }
+        void Update(float dt) override
+        {
+            Scene& scene = *mpActiveScene;
+            ChangeTick since = mLastTick;
+            mLastTick = scene.GetTick() + 1;
+
+            // Remove entities, which were destroyed or lost their Transform2D. Index may have been reused by a new entity,
+            // which still matches, and that one is updated below.
+            mQuery->ConsumeRemoved([this](EntityIndex index) {
+                if (!mQuery->Contains(index))
+                    mIndex.RemoveIndex(index);
+            });
+
+            // Components are stamped as changed also when they are added, so this covers new entities too.
+            SceneView<Changed<Transform2D>>(scene, since).each([&](EntityID ent, const Transform2D& trans) { updateEntity(ent, trans); });
+            SceneView<Changed<WorldTransform2D>, Transform2D>(scene, since).each([&](EntityID ent, const WorldTransform2D&, const Transform2D& trans) { updateEntity(ent, trans); });
+        }
+
+    protected:
+        SpatialIndex mIndex;
+        ChangeTick mLastTick{ 0 };
+        // Entities with Transform2D. Records the entities, which leave it.
+        std::optional<CachedQuery<With<Transform2D>>> mQuery;
+
+        void updateEntity(EntityID ent, const Transform2D& trans)
+        {
+            if (const WorldTransform2D* p_world = mpActiveScene->Get<WorldTransform2D>(ent))
+                mIndex.Update(ent, AABB2D::FromTransformedQuad(p_world->matrix, trans.scale));
+            else if (trans.rotation == 0.0f)
+                mIndex.Update(ent, { glm::min(trans.position, trans.position + trans.scale), glm::max(trans.position, trans.position + trans.scale) });
+            else
+                mIndex.Update(ent, AABB2D::FromTransformedQuad(WorldTransform2D::FromLocal(trans), trans.scale));
+        }
     };
 
     // Manages all systems --> Is calling required methods etc.
-    // TODO: multithreading for certain systems.
+    // - Systems are called in the order they were added.
+    // - Update() runs systems with declared component access (see System::Reads() and System::Writes()) on the thread pool.
+    //   Systems that conflict are run in the order they were added, so the result is deterministic.
+    // - Init(), Destroy(), ProcessInput() and Render() are always called serially on the calling thread.
+    // - Commands recorded into command buffers (see GetCommandBuffer()) are played back after ProcessInput() and Update().
     class SystemsManager
     {
         typedef int32_t SystemID;
@@ -157,33 +477,30 @@ namespace Ren::ecs
         template<typename TSystem>
         TSystem* AddSystem()
         {
+            REN_ASSERT(findSystem(getSystemID<TSystem>()) == mSystems.end(), "System is already added.");
+
             TSystem* instance = new TSystem();
+            instance->mpCommandBuffers = mCommandBuffers.get();
+            instance->mpThreadPool = &mCommandBuffers->GetPool();
             instance->SetScene(mpManagedScene);
-
-            if (!mAvailableSystemIDs.empty()) {
-                mSystems[mAvailableSystemIDs.back()] = Ref<System>(instance);
-                mAvailableSystemIDs.pop_back();
-            }
-            else
-                mSystems.emplace(getSystemID<TSystem>(), Ref<System>(instance));
+            mSystems.push_back({ getSystemID<TSystem>(), Ref<System>(instance) });
 
             return instance;
         }
         template<typename TSystem>
         void RemoveSystem()
         {
-            SystemID id = getSystemID<TSystem>();
-            REN_ASSERT(mSystems.count(id) > 0, "Trying to remove system, that was not added.");
-            mSystems[id].reset();
-            mAvailableSystemIDs.push_back(id);
+            auto it = findSystem(getSystemID<TSystem>());
+            REN_ASSERT(it != mSystems.end(), "Trying to remove system, that was not added.");
+            mSystems.erase(it);
         }
         template<typename TSystem>
         TSystem* GetSystem()
         {
-            SystemID id = getSystemID<TSystem>();
-            if (mSystems.count(id) == 0)
+            auto it = findSystem(getSystemID<TSystem>());
+            if (it == mSystems.end())
                 return nullptr;
-            return dynamic_cast<TSystem>(mSystems[id].get());
+            return dynamic_cast<TSystem*>(it->second.get());
         }
         void SetScene(Scene* p_scene) 
         {   
@@ -194,6 +511,30 @@ namespace Ren::ecs
                 sys->SetScene(mpManagedScene);
         }
         inline Scene* GetScene() { return mpManagedScene; }
+        // Set thread pool used for updating systems. If nullptr, systems are updated serially.
+        void SetThreadPool(ThreadPool* p_pool)
+        {
+            PlaybackCommands();
+            mpThreadPool = p_pool;
+            mCommandBuffers.reset(new PerThread<EntityCommandBuffer>(mpThreadPool ? *mpThreadPool : ThreadPool::Get()));
+            for (auto&& [id, sys] : mSystems)
+            {
+                sys->mpCommandBuffers = mCommandBuffers.get();
+                sys->mpThreadPool = &mCommandBuffers->GetPool();
+                sys->SetScene(mpManagedScene);
+            }
+        }
+        // Command buffer of the calling thread.
+        inline EntityCommandBuffer& GetCommandBuffer() { return mCommandBuffers->Local(); }
+        // Apply commands recorded by all threads to the managed scene. Buffers are played back in the order of thread indices.
+        void PlaybackCommands()
+        {
+            if (!mpManagedScene)
+                return;
+            for (auto&& buffer : *mCommandBuffers)
+                if (!buffer.Empty())
+                    buffer.Playback(*mpManagedScene);
+        }
 
         // System functions
         void Init()
@@ -211,22 +552,49 @@ namespace Ren::ecs
         {
             for (auto&& [id, sys] : mSystems)
                 sys->ProcessInput(input);
+            PlaybackCommands();
         };
         void Update(float dt)
         {
-            for (auto&& [id, sys] : mSystems)
-                sys->Update(dt);
+            if (!mpThreadPool || mpThreadPool->GetWorkerCount() == 0 || mSystems.size() < 2)
+            {
+                for (auto&& [id, sys] : mSystems)
+                    sys->Update(dt);
+            }
+            else
+            {
+                buildSchedule();
+                runSchedule([dt](System* sys) { sys->Update(dt); });
+            }
+            // Changes made by the commands belong to the next tick, so systems, which already processed this tick, see them.
+            if (mpManagedScene)
+                mpManagedScene->AdvanceTick();
+            PlaybackCommands();
         };
+        // Render all systems and end the frame by advancing the scene tick, so that changes made in the next update
+        // are stamped with a tick, which is newer than the one rendered.
         void Render()
         {
             for (auto&& [id, sys] : mSystems)
                 sys->Render();
+            if (mpManagedScene)
+                mpManagedScene->AdvanceTick();
         };
     
     protected:
         Scene* mpManagedScene{ nullptr };
-        std::unordered_map<SystemID, Ref<System>> mSystems;
-        std::vector<SystemID> mAvailableSystemIDs;
+        std::vector<std::pair<SystemID, Ref<System>>> mSystems;
+        ThreadPool* mpThreadPool{ &ThreadPool::Get() };
+        std::unique_ptr<PerThread<EntityCommandBuffer>> mCommandBuffers{ new PerThread<EntityCommandBuffer>(*mpThreadPool) };
+
+        // Node of the dependency graph. System with index i in mSystems is represented by mSchedule[i].
+        struct schedule_node {
+            // Systems which have to wait for this system to finish.
+            std::vector<uint32_t> dependents;
+            // Number of systems this system has to wait for.
+            uint32_t dependency_count{ 0 };
+        };
+        std::vector<schedule_node> mSchedule;
 
         // Get unique system ID for each system type.
         inline static SystemID mLastSystemID = 0;
@@ -236,5 +604,46 @@ namespace Ren::ecs
             static SystemID id = mLastSystemID++;
             return id;
         }
+        inline std::vector<std::pair<SystemID, Ref<System>>>::iterator findSystem(SystemID id)
+        {
+            return std::find_if(mSystems.begin(), mSystems.end(), [id](const auto& entry) { return entry.first == id; });
+        }
+
+        // Build dependency graph from declared system accesses. System depends on every earlier added system it conflicts with.
+        void buildSchedule()
+        {
+            mSchedule.assign(mSystems.size(), schedule_node());
+            for (uint32_t i = 0; i < mSystems.size(); i++)
+                for (uint32_t j = i + 1; j < mSystems.size(); j++)
+                    if (mSystems[i].second->GetAccess().ConflictsWith(mSystems[j].second->GetAccess()))
+                    {
+                        mSchedule[i].dependents.push_back(j);
+                        mSchedule[j].dependency_count++;
+                    }
+        }
+        // Run given function for every system on the thread pool, respecting the dependency graph. Returns when all systems are done.
+        template<typename TFunc>
+        void runSchedule(TFunc func)
+        {
+            uint32_t count = uint32_t(mSchedule.size());
+            std::unique_ptr<std::atomic<uint32_t>[]> pending(new std::atomic<uint32_t>[count]);
+            for (uint32_t i = 0; i < count; i++)
+                pending[i] = mSchedule[i].dependency_count;
+            std::atomic<uint32_t> remaining{ count };
+
+            std::function<void(uint32_t)> run_system = [&](uint32_t i) {
+                func(mSystems[i].second.get());
+                // Release systems that were waiting only for this one.
+                for (auto&& dependent : mSchedule[i].dependents)
+                    if (--pending[dependent] == 0)
+                        mpThreadPool->Submit([&run_system, dependent] { run_system(dependent); });
+                remaining--;
+            };
+
+            for (uint32_t i = 0; i < count; i++)
+                if (mSchedule[i].dependency_count == 0)
+                    mpThreadPool->Submit([&run_system, i] { run_system(i); });
+            mpThreadPool->WaitUntil([&remaining] { return remaining == 0; });
+        }
     };
 };
\ No newline at end of file
@@ -2,4 +2,8 @@
 // Include all header files related to Entity Component System. //
 
 #include "SceneView.hpp" // Already includes Scene.hpp
-#include "Systems.hpp"   // Components and systems.
\ No newline at end of file
+#include "Query.hpp"
+#include "SpatialIndex.hpp"
+#include "CommandBuffer.hpp"
+#include "Systems.hpp"   // Components and systems.
+#include "SceneSerializer.hpp"
\ No newline at end of file